@@ -0,0 +1,159 @@
+#include "arena.h"
+#include <string.h>
+#include <new>
+#include <algorithm>
+
+#define ARENA_BLOCK (64 << 10)
+#define ALIGNMENT 8
+#define MIN_UNIQUES 16
+
+enum
+{
+	DEAD_OBJECT,
+	LIVE_OBJECT,
+	HEAP_OBJECT,
+};
+
+thread_local Arena* Arena::current = NULL;
+
+Arena::Arena() : uniqueCount(0)
+{
+	memset(&stats, 0, sizeof(stats));
+	for (int i = 0; i < ARENA_KINDS; i++)
+	{
+		regions[i].next = regions[i].end = NULL;
+		regions[i].destroy = NULL;
+	}
+}
+
+Arena::~Arena()
+{
+	reset();
+}
+
+void* Arena::allocate(ArenaKindT kind, size_t size, DestroyT destroy)
+{
+	if (current != NULL)
+		return current->bump(kind, size, destroy);
+	HeaderT* header = static_cast<HeaderT*>(::operator new(sizeof(HeaderT) + size));
+	header->size = size;
+	header->state = HEAP_OBJECT;
+	return header + 1;
+}
+
+/* an object deleted (or whose constructor threw) is only marked, its block goes with the arena */
+void Arena::release(void* p)
+{
+	HeaderT* header = static_cast<HeaderT*>(p) - 1;
+	if (header->state == HEAP_OBJECT)
+		::operator delete(header);
+	else
+		header->state = DEAD_OBJECT;
+}
+
+/*
+	the slot for the one object the current arena derives from key, e.g.
+	the pointer type to a type; empty until the caller fills it, NULL when
+	no arena is current. Keys are addresses, which a bump allocator never
+	hands out twice, so an entry stays right until the arena is reset
+*/
+void** Arena::unique(const void* key)
+{
+	if (current == NULL)
+		return NULL;
+	vector<UniqueT>& uniques = current->uniques;
+	if ((current->uniqueCount + 1) * 4 > uniques.size() * 3)
+	{
+		vector<UniqueT> old(max(uniques.size() * 2, (size_t)MIN_UNIQUES));
+		old.swap(uniques);
+		current->uniqueCount = 0;
+		for (size_t i = 0; i < old.size(); i++)
+			if (old[i].key != NULL)
+				*unique(old[i].key) = old[i].value;
+	}
+	size_t mask = uniques.size() - 1;
+	size_t h = (size_t)key / ALIGNMENT * 2654435769u;
+	size_t i = (h ^ h >> 15) & mask;
+	while (uniques[i].key != NULL && uniques[i].key != key)
+		i = (i + 1) & mask;
+	if (uniques[i].key == NULL)
+	{
+		uniques[i].key = key;
+		uniques[i].value = NULL;
+		++current->uniqueCount;
+	}
+	return &uniques[i].value;
+}
+
+/*
+	an object too big for a block gets a block of its own, put before the
+	one being filled so that the filling goes on
+*/
+void* Arena::bump(ArenaKindT kind, size_t size, DestroyT destroy)
+{
+	RegionT& region = regions[kind];
+	size_t need = sizeof(HeaderT) + ((size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1));
+	if (region.next == NULL || (size_t)(region.end - region.next) < need)
+	{
+		size_t blockSize = need > ARENA_BLOCK / 4 ? need : ARENA_BLOCK;
+		char* block = static_cast<char*>(::operator new(blockSize));
+		stats.reserved += blockSize;
+		if (blockSize == ARENA_BLOCK)
+		{
+			if (region.next != NULL)
+				region.ends.back() = region.next;
+			region.blocks.push_back(block);
+			region.ends.push_back(NULL);
+			region.next = block;
+			region.end = block + blockSize;
+		}
+		else
+		{
+			size_t at = region.next == NULL ? region.blocks.size() : region.blocks.size() - 1;
+			region.blocks.insert(region.blocks.begin() + at, block);
+			region.ends.insert(region.ends.begin() + at, block + need);
+			HeaderT* header = reinterpret_cast<HeaderT*>(block);
+			header->size = need - sizeof(HeaderT);
+			header->state = LIVE_OBJECT;
+			region.destroy = destroy;
+			++stats.allocations;
+			stats.bytes += need;
+			return header + 1;
+		}
+	}
+	HeaderT* header = reinterpret_cast<HeaderT*>(region.next);
+	header->size = need - sizeof(HeaderT);
+	header->state = LIVE_OBJECT;
+	region.next += need;
+	region.destroy = destroy;
+	++stats.allocations;
+	stats.bytes += need;
+	return header + 1;
+}
+
+void Arena::reset()
+{
+	for (int i = 0; i < ARENA_KINDS; i++)
+	{
+		RegionT& region = regions[i];
+		if (region.next != NULL)
+			region.ends.back() = region.next;
+		for (size_t b = 0; b < region.blocks.size(); b++)
+		{
+			for (char* p = region.blocks[b]; p < region.ends[b]; )
+			{
+				HeaderT* header = reinterpret_cast<HeaderT*>(p);
+				if (header->state == LIVE_OBJECT)
+					region.destroy(header + 1);
+				p += sizeof(HeaderT) + header->size;
+			}
+			::operator delete(region.blocks[b]);
+		}
+		region.blocks.clear();
+		region.ends.clear();
+		region.next = region.end = NULL;
+	}
+	memset(&stats, 0, sizeof(stats));
+	uniques.clear();
+	uniqueCount = 0;
+}
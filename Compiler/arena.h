@@ -0,0 +1,85 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <stddef.h>
+#include <vector>
+
+using namespace std;
+
+typedef enum
+{
+	NODE_ARENA,
+	SYMBOL_ARENA,
+	TABLE_ARENA,
+	ARENA_KINDS,
+}ArenaKindT;
+
+typedef struct
+{
+	unsigned long allocations, bytes, reserved;
+}ArenaStatsT;
+
+/*
+	bump allocator that owns the front end of one compilation: nodes,
+	symbols and tables each fill their own blocks, so a tree walk stays on
+	few pages. An object is preceded by an 8 byte header with its size, so
+	reset can walk the blocks and destroy what is still alive. Objects made
+	while no arena is current come from the heap with the same header
+*/
+class Arena
+{
+private :
+
+	typedef void (*DestroyT)(void*);
+
+	typedef struct
+	{
+		unsigned int size, state;
+	}HeaderT;
+
+	typedef struct
+	{
+		vector<char*> blocks, ends;
+		char *next, *end;
+		DestroyT destroy;
+	}RegionT;
+
+	typedef struct
+	{
+		const void* key;
+		void* value;
+	}UniqueT;
+
+	RegionT regions[ARENA_KINDS];
+	ArenaStatsT stats;
+	vector<UniqueT> uniques;
+	size_t uniqueCount;
+
+	void* bump(ArenaKindT kind, size_t size, DestroyT destroy);
+	Arena(const Arena&);
+	Arena& operator=(const Arena&);
+public :
+
+	static thread_local Arena* current;
+	static void* allocate(ArenaKindT kind, size_t size, DestroyT destroy);
+	static void release(void* p);
+	static void** unique(const void* key);
+
+	Arena();
+	~Arena();
+	void reset();
+	ArenaStatsT getStats() const {return stats;}
+};
+
+/* makes an arena current for the front end code it encloses */
+class ArenaScope
+{
+private :
+
+	Arena* previous;
+public :
+
+	ArenaScope(Arena& arena) : previous(Arena::current) {Arena::current = &arena;}
+	~ArenaScope() {Arena::current = previous;}
+};
+
+#endif
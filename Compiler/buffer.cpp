@@ -1,57 +1,304 @@
 #include "buffer.h"
+#include <string.h>
+#include <algorithm>
+#include <stdexcept>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
-FILE  *stream;
-bool isEOF = false, isEOLN = false, is;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SSE2_KERNELS
+#include <emmintrin.h>
+#endif
 
-Buffered_stream::Buffered_stream(FILE* f, int& _line, int& _col) : pos(0), size(0), line(_line), col(_col) {stream = f;};
+#if defined(SSE2_KERNELS) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AVX2_KERNELS
+#include <immintrin.h>
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
 
-char Buffered_stream::get()
+#ifdef _MSC_VER
+#include <intrin.h>
+
+static __inline int lowestBit(unsigned int mask)
+{
+	unsigned long i;
+	_BitScanForward(&i, mask);
+	return i;
+}
+#else
+static __inline int lowestBit(unsigned int mask)
+{
+	return __builtin_ctz(mask);
+}
+#endif
+
+thread_local const Source_buffer* Source_buffer::current = NULL;
+
+static vector<const Source_buffer*> included;
+static vector<size_t> includedBases;
+static size_t nextBase = INCLUDE_BASE;
+static mutex includedLock;
+
+/*
+	a mapping follows the file, so callers that keep the text while the
+	file may be rewritten in place ask for a private copy instead
+*/
+Source_buffer::Source_buffer(FILE* f, bool isMappable) : data(NULL), length(0), base(0), isMapped(false)
+{
+#ifndef _WIN32
+	struct stat st;
+	int fd = fileno(f);
+	if (isMappable && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+	{
+		void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED)
+		{
+			madvise(p, st.st_size, MADV_SEQUENTIAL);
+			data = static_cast<const char*>(p);
+			length = st.st_size;
+			isMapped = true;
+			return;
+		}
+	}
+#endif
+	readStream(f);
+}
+
+Source_buffer::Source_buffer(const char* text, size_t size) : data(NULL), length(size), base(0), isMapped(false), storage(text, text + size)
+{
+	data = length == 0 ? NULL : &storage[0];
+}
+
+Source_buffer::~Source_buffer()
+{
+	if (current == this)
+		current = NULL;
+#ifndef _WIN32
+	if (isMapped)
+		munmap(const_cast<char*>(data), length);
+#endif
+}
+
+/*
+	an included file gets its own range of offsets above INCLUDE_BASE (one
+	past the end for its EOF), so a token offset alone tells which file it
+	points into; included buffers are kept until forgetIncludes
+*/
+void Source_buffer::include()
+{
+	lock_guard<mutex> guard(includedLock);
+	if (nextBase + length + 1 >= 0xFFFFFFFF)
+		throw length_error("include location space is full");
+	base = nextBase;
+	nextBase += length + 1;
+	included.push_back(this);
+	includedBases.push_back(base);
+}
+
+/* once nothing points into the included buffers any more their offsets can be handed out again */
+void Source_buffer::forgetIncludes()
+{
+	lock_guard<mutex> guard(includedLock);
+	included.clear();
+	includedBases.clear();
+	nextBase = INCLUDE_BASE;
+}
+
+const Source_buffer* Source_buffer::owner(size_t offset)
+{
+	if (offset < INCLUDE_BASE)
+		return current;
+	lock_guard<mutex> guard(includedLock);
+	size_t i = upper_bound(includedBases.begin(), includedBases.end(), offset) - includedBases.begin();
+	return i == 0 ? NULL : included[i - 1];
+}
+
+void Source_buffer::readStream(FILE* f)
+{
+	char buffer[BUFFER_SIZE];
+	size_t count;
+	while ((count = fread(buffer, sizeof(char), BUFFER_SIZE, f)) != 0)
+		storage.insert(storage.end(), buffer, buffer + count);
+	length = storage.size();
+	data = length == 0 ? NULL : &storage[0];
+}
+
+void Source_buffer::indexLines() const
+{
+	lineStarts.push_back(0);
+	findLineStarts(data, data + length, lineStarts);
+}
+
+/*
+	offsets past the end keep counting columns on the last line, the way
+	the scanner does when it reads EOF more than once; the table is built
+	once even when chunk scanners on several threads report errors
+*/
+void Source_buffer::locate(size_t offset, int& line, int& col) const
+{
+	call_once(linesFlag, &Source_buffer::indexLines, this);
+	vector<unsigned int>::const_iterator it = upper_bound(lineStarts.begin(), lineStarts.end(), offset) - 1;
+	line = it - lineStarts.begin() + 1;
+	col = offset - *it + 1;
+}
+
+static __inline bool isBlank(char ch)
+{
+	return ch == '\n' || ch == '\t' || ch == '\v' || ch == ' ';
+}
+
+static const char* findNonBlankScalar(const char* p, const char* end)
 {
-	++col;
-	if (isEOF)
-		return EOF;
-	if (!hasNext())
+	while (p < end && isBlank(*p))
+		++p;
+	return p;
+}
+
+static const char* findCommentEndScalar(const char* p, const char* end)
+{
+	for (; p + 1 < end; p++)
+		if (p[0] == '*' && p[1] == '/')
+			return p;
+	return end;
+}
+
+static void findLineStartsScalar(const char* begin, const char* p, const char* end, vector<unsigned int>& starts)
+{
+	for (; p < end; p++)
+		if (*p == '\n')
+			starts.push_back(p - begin + 1);
+}
+
+static __inline void pushLineStarts(unsigned int mask, size_t offset, vector<unsigned int>& starts)
+{
+	for (; mask != 0; mask &= mask - 1)
+		starts.push_back(offset + lowestBit(mask) + 1);
+}
+
+#ifdef SSE2_KERNELS
+static __inline unsigned int blankMask(__m128i v)
+{
+	__m128i blank = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))),
+		_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\v'))));
+	return _mm_movemask_epi8(blank);
+}
+
+static const char* findNonBlankSSE2(const char* p, const char* end)
+{
+	for (; p + 16 <= end; p += 16)
 	{
-		pos = 0;
-		size = fread(buffer, sizeof(char), BUFFER_SIZE, stream);
-		isEOF = !size;
+		unsigned int mask = ~blankMask(_mm_loadu_si128((const __m128i*)p)) & 0xFFFF;
+		if (mask != 0)
+			return p + lowestBit(mask);
 	}
-	if (isEOLN)
+	return findNonBlankScalar(p, end);
+}
+
+static const char* findCommentEndSSE2(const char* p, const char* end)
+{
+	for (; p + 17 <= end; p += 16)
 	{
-		isEOLN = false;
-		++line;
-		col = 1;
+		__m128i star = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), _mm_set1_epi8('*'));
+		__m128i slash = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 1)), _mm_set1_epi8('/'));
+		unsigned int mask = _mm_movemask_epi8(_mm_and_si128(star, slash));
+		if (mask != 0)
+			return p + lowestBit(mask);
 	}
-	char ch = isEOF ? EOF : buffer[pos++];
-	isEOLN = ch == '\n';
-	return ch;
+	return findCommentEndScalar(p, end);
 }
 
-void Buffered_stream::fillQueueFrom(queue<char> &_queue, int index)
+static void findLineStartsSSE2(const char* begin, const char* p, const char* end, vector<unsigned int>& starts)
 {
-	if (!size || index > pos)
-		return;
-	for (; index < pos; index++) 
-		_queue.push(buffer[index]);
+	for (; p + 16 <= end; p += 16)
+		pushLineStarts(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), _mm_set1_epi8('\n'))), p - begin, starts);
+	findLineStartsScalar(begin, p, end, starts);
+}
+#endif
+
+#ifdef AVX2_KERNELS
+static AVX2_TARGET const char* findNonBlankAVX2(const char* p, const char* end)
+{
+	for (; p + 32 <= end; p += 32)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)p);
+		__m256i blank = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\v'))));
+		unsigned int mask = ~(unsigned int)_mm256_movemask_epi8(blank);
+		if (mask != 0)
+			return p + lowestBit(mask);
+	}
+	return findNonBlankSSE2(p, end);
+}
+
+static AVX2_TARGET const char* findCommentEndAVX2(const char* p, const char* end)
+{
+	for (; p + 33 <= end; p += 32)
+	{
+		__m256i star = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), _mm256_set1_epi8('*'));
+		__m256i slash = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + 1)), _mm256_set1_epi8('/'));
+		unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(star, slash));
+		if (mask != 0)
+			return p + lowestBit(mask);
+	}
+	return findCommentEndSSE2(p, end);
 }
 
-int Buffered_stream::getpos()
+static AVX2_TARGET void findLineStartsAVX2(const char* begin, const char* p, const char* end, vector<unsigned int>& starts)
 {
-	return pos - 1;
+	for (; p + 32 <= end; p += 32)
+		pushLineStarts(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), _mm256_set1_epi8('\n'))), p - begin, starts);
+	findLineStartsSSE2(begin, p, end, starts);
 }
 
-void Buffered_stream::back(int count)
+static bool detectAVX2()
 {
-	col -= count;
-	if (isEOF)
-		return;
-	if (pos - count >= 0)
-		pos -= count;
-	if (isEOLN)
-		isEOLN = false;
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
 }
 
-bool Buffered_stream::hasNext()
+static bool hasAVX2 = detectAVX2();
+#endif
+
+const char* findNonBlank(const char* p, const char* end)
+{
+#ifdef AVX2_KERNELS
+	if (hasAVX2)
+		return findNonBlankAVX2(p, end);
+#endif
+#ifdef SSE2_KERNELS
+	return findNonBlankSSE2(p, end);
+#else
+	return findNonBlankScalar(p, end);
+#endif
+}
+
+const char* findCommentEnd(const char* p, const char* end)
+{
+#ifdef AVX2_KERNELS
+	if (hasAVX2)
+		return findCommentEndAVX2(p, end);
+#endif
+#ifdef SSE2_KERNELS
+	return findCommentEndSSE2(p, end);
+#else
+	return findCommentEndScalar(p, end);
+#endif
+}
+
+void findLineStarts(const char* begin, const char* end, vector<unsigned int>& starts)
 {
-	return pos != size;
+#ifdef AVX2_KERNELS
+	if (hasAVX2)
+	{
+		findLineStartsAVX2(begin, begin, end, starts);
+		return;
+	}
+#endif
+#ifdef SSE2_KERNELS
+	findLineStartsSSE2(begin, begin, end, starts);
+#else
+	findLineStartsScalar(begin, begin, end, starts);
+#endif
 }
@@ -1,33 +1,73 @@
 #ifndef BUFFER_H
 #define BUFFER_H
 #define BUFFER_SIZE 4096
+#define INCLUDE_BASE 0x80000000u
 #include <stdio.h>
-#include <queue>
+#include <vector>
 #include <sstream>
 #include <stdlib.h>
 #include <iostream>
+#include <mutex>
 
 using namespace std;
 
-class Buffered_stream
+class Source_buffer
 {
 private:
 
-	char buffer[BUFFER_SIZE];
-	int pos, size, &line, &col;
+	const char* data;
+	size_t length, base;
+	bool isMapped;
+	vector<char> storage;
+	mutable vector<unsigned int> lineStarts;
+	mutable once_flag linesFlag;
 
+	static thread_local const Source_buffer* current;
+
+	void readStream(FILE* f);
+	void indexLines() const;
+	friend class SourceScope;
 public:
 
-	Buffered_stream(FILE* f, int& _line, int& _col);
-	char get();
-	int getpos();
-	bool hasNext();
-	void fillQueueFrom(queue<char> &_queue, int index); 
-	void back(int count);
+	static const Source_buffer* owner(size_t offset);
+
+	Source_buffer(FILE* f, bool isMappable = true);
+	Source_buffer(const char* text, size_t size);
+	~Source_buffer();
+	void include();
+	static void forgetIncludes();
+	size_t getBase() const {return base;}
+	const char* begin() const {return data;}
+	const char* end() const {return data + length;}
+	size_t size() const {return length;}
+	void locate(size_t offset, int& line, int& col) const;
+};
+
+/*
+	tokens keep only offsets, so offsets below INCLUDE_BASE need the main
+	file of the compilation running on this thread: the parser and the
+	preprocessor make their source current while they work
+*/
+class SourceScope
+{
+private :
+
+	const Source_buffer* previous;
+public :
+
+	SourceScope(const Source_buffer* source) : previous(Source_buffer::current) {Source_buffer::current = source;}
+	~SourceScope() {Source_buffer::current = previous;}
 };
 
+/*
+	byte scanning kernels for skipping blanks and comments; they work on
+	32 (AVX2) or 16 (SSE2) bytes at a time when the CPU allows it
+*/
+extern const char* findNonBlank(const char* p, const char* end);
+extern const char* findCommentEnd(const char* p, const char* end);
+extern void findLineStarts(const char* begin, const char* end, vector<unsigned int>& starts);
 
-template<typename T> 
+template<typename T>
 extern string to_string(const T& v)
 {
     ostringstream stm;
@@ -1,5 +1,6 @@
 #include "codeGen.h"
 #include <math.h>
+#include <algorithm>
 
 #define COM(it) (static_cast<AsmCommand*>(*it))
 
@@ -129,8 +130,13 @@ void AsmDQ::print(ostream& s)
 
 void AsmDB::print(ostream& s)
 {
-#define IS_WHT(ch) (ch == '\n' || ch == '\f')
 	s << name << "\tdb\t";
+	printBytes(s, value);
+}
+
+void AsmDB::printBytes(ostream& s, const string& value)
+{
+#define IS_WHT(ch) (ch == '\n' || ch == '\f')
 	bool needQuote = true;
 	if ((value.size() > 0 && (value[value.length() - 1] != '\"')) || (value.size() == 2))
 	{
@@ -150,6 +156,17 @@ void AsmDB::print(ostream& s)
 #undef IS_WHT
 }
 
+void AsmStringConst::print(ostream& s)
+{
+	if (owner != NULL)
+	{
+		s << name << "\tequ\t<" << owner->name << " + " << shift << ">" << endl;
+		return;
+	}
+	s << name << "\tdb\t";
+	AsmDB::printBytes(s, getText());
+}
+
 void AsmFunction::print(ostream& s)
 {
 	s <<  name + (name != "main" ? " proc" : ":") << "\n\n";
@@ -179,14 +196,46 @@ void AsmLocalVar::print(ostream& s)
 	s << l + " = " + r << endl;
 }
 
-CodeGen::CodeGen(Parser& _parser, const string& out) : parser(_parser), outStream(out.c_str()), stacksLevel(0), lablesCount(0)
+CodeGen::CodeGen(Parser& _parser, const string& out) : parser(_parser), file(out.c_str()), outStream(file), stacksLevel(0), lablesCount(0)
+{
+	parser.parse();
+	globalTable = parser.getGlobalTable();
+}
+
+CodeGen::CodeGen(Parser& _parser, ostream& out) : parser(_parser), outStream(out), stacksLevel(0), lablesCount(0)
 {
 	parser.parse();
 	globalTable = parser.getGlobalTable();
 }
 
+/*
+	a literal that ends another one (terminator included) is emitted as an
+	offset into it: sorting the reversed texts puts every literal right
+	before the ones it is a suffix of
+*/
+void CodeGen::shareStringSuffixes()
+{
+	vector< pair<string, AsmStringConst*> > reversed;
+	for (size_t i = 0; i < stringData.size(); i++)
+	{
+		const string& text = stringData[i]->getText();
+		reversed.push_back(make_pair(string(text.rbegin() + 1, text.rend() - 1), stringData[i]));
+	}
+	sort(reversed.begin(), reversed.end());
+	vector<size_t> root(reversed.size());
+	for (int i = (int)reversed.size() - 1; i >= 0; i--)
+	{
+		root[i] = i;
+		if (i + 1 < (int)reversed.size() && reversed[i + 1].first.compare(0, reversed[i].first.size(), reversed[i].first) == 0)
+			root[i] = root[i + 1];
+		if (root[i] != (size_t)i)
+			reversed[i].second->share(reversed[root[i]].second, reversed[root[i]].first.size() - reversed[i].first.size());
+	}
+}
+
 void CodeGen::printData()
 {
+	shareStringSuffixes();
 	// for (auto &x : data)
 	// 	x->print(outStream);
 	for (list<AsmData*>::iterator it = data.begin(); it != data.end(); ++it)
@@ -212,8 +261,11 @@ void CodeGen::generate()
 	"includelib C:\\masm32\\lib\\msvcrt.lib\n\n"
 	".xmm\n\n"
 	".data\n\n";
+	SourceScope scope(parser.getSource());
 	Symbol* main = NULL;
 	bool hasCodeLabel = false;
+	parser.foldConstants();
+	parser.flatten();
 	parser.initFunctionsAndVars();
 	vector<Symbol*> vars = parser.getVars(), functions = parser.getFunctions();
 
@@ -404,6 +456,11 @@ void CodeGen::addData(string name)
 	data.push_back(new AsmData(name, string()));
 }
 
+void CodeGen::addAlign(size_t align)
+{
+	data.push_back(new AsmAlign(to_string(align)));
+}
+
 void CodeGen::addFunc(string name)
 {
 	functions.push_back(new AsmFunction(name));
@@ -526,7 +583,6 @@ void CodeGen::insertConst(TypeT type, string value)
 	switch(type)
 	{
 	case DOUBLE : doubles[value] = getPrefix(PR(doubles), PREFIX_DOUBLE_CONST);break;
-	case STRING : strings[value] = getPrefix(PR(strings), PREFIX_STRING_CONST);break;
 	case FLOAT  : floats[value] = getPrefix(PR(floats), PREFIX_FLOAT_CONST);
 	}
 #undef PR
@@ -539,7 +595,6 @@ bool CodeGen::hasConst(TypeT type, string value)
 	switch(type)
 	{
 	case DOUBLE : return HAS(doubles, value);
-	case STRING : return HAS(strings, value);
 	case FLOAT  : return HAS(floats, value);
 	default : return false;
 	}
@@ -547,12 +602,23 @@ bool CodeGen::hasConst(TypeT type, string value)
 #undef HAS
 }
 
+string CodeGen::getStringConst(unsigned int id)
+{
+	map<unsigned int, string>::iterator it = strings.find(id);
+	if (it != strings.end())
+		return it->second;
+	string name = getPrefix(to_string(strings.size() + 1), PREFIX_STRING_CONST);
+	strings[id] = name;
+	stringData.push_back(new AsmStringConst(name, id));
+	data.push_back(stringData.back());
+	return name;
+}
+
 string CodeGen::getConst(TypeT type, string value)
 {
     switch(type)
 	{
 	case DOUBLE : return doubles[value];
-	case STRING : return strings[value];
 	case FLOAT  : return floats[value];
 	}
 }
\ No newline at end of file
@@ -228,6 +228,30 @@ public :
 
 	AsmDB(string& _name, const string& _value) : AsmData(_name, _value){};
 	void print(ostream& s);
+	static void printBytes(ostream& s, const string& value);
+};
+
+class AsmAlign : public AsmData
+{
+public :
+
+	AsmAlign(const string& _value) : AsmData(string(), _value){};
+	void print(ostream& s){s << "align " << value << endl;}
+};
+
+class AsmStringConst : public AsmData
+{
+private :
+
+	unsigned int id;
+	AsmStringConst* owner;
+	size_t shift;
+public :
+
+	AsmStringConst(string& _name, unsigned int _id) : AsmData(_name, string()), id(_id), owner(NULL), shift(0){};
+	const string& getText(){return Token::textOf(id);}
+	void share(AsmStringConst* _owner, size_t _shift){owner = _owner; shift = _shift;}
+	void print(ostream& s);
 };
 
 class CodeGen
@@ -236,20 +260,25 @@ private:
 
 	Parser& parser;
 	SymbolTable* globalTable;
-	ofstream outStream;
+	ofstream file;
+	ostream& outStream;
 	list<AsmData*> data;
 	list<AsmFunction*> functions;
 	stack< pair<string, string> > jump;
-	map<string, string> doubles, strings, floats;
+	map<string, string> doubles, floats;
+	map<unsigned int, string> strings;
+	vector<AsmStringConst*> stringData;
 	int stacksLevel, lablesCount;
 public:
 
 	CodeGen(Parser& _parser, const string& out);
+	CodeGen(Parser& _parser, ostream& out);
 	void generate();
 	void addDD(string name, const string value, size_t size);
 	void addDQ(string name, const string value, size_t size);
 	void addDB(string name, const string value);
 	void addData(string name);
+	void addAlign(size_t align);
 	void addFunc(string name);
 	void addCommand(CommandT com, string l, string r);
 	void addCommand(CommandT com, string l, int size = 4);
@@ -258,6 +287,7 @@ public:
 	void addLabel(string label);
 	string genLabel();
 	void addEoln(int count);
+	void shareStringSuffixes();
 	void printData();
 	void printFunctions();
 	void shiftStack(int shift){stacksLevel += shift;};
@@ -275,6 +305,7 @@ public:
 	void insertConst(TypeT type, string value);
 	void optimize();
 	string getConst(TypeT type, string value);
+	string getStringConst(unsigned int id);
 	//void addElementInArray(string element, size_t elementSize);
 	//void 
 };
@@ -0,0 +1,80 @@
+#include "compilation.h"
+#include "preprocessor.h"
+#include <thread>
+
+Compilation::Compilation(FILE* file, const string& name) : filename(name), threads(0), isPretokenized(false)
+{
+	source = new Source_buffer(file);
+}
+
+Compilation::Compilation(const string& text, const string& name) : filename(name), threads(0), isPretokenized(false)
+{
+	source = new Source_buffer(text.data(), text.size());
+}
+
+Compilation::~Compilation()
+{
+	delete source;
+}
+
+/* the command line key, e.g. -gt or -gp: 't' after the mode pretokenizes, 'p' parses bodies in parallel */
+void Compilation::setFlags(const string& key)
+{
+	if (key.size() > 2 && key[2] == 't')
+		setPretokenized();
+	if (key.size() > 2 && key.find('p', 2) != string::npos)
+		setParallel(max(1u, thread::hardware_concurrency()));
+}
+
+/* what the command line writes to <name>.asm: the assembly, or every error on a line of its own */
+string Compilation::getOutput() const
+{
+	string output = assembly;
+	for (size_t i = 0; i < errors.size(); i++)
+		output += errors[i] + "\n";
+	return output;
+}
+
+/* the file name with its extension replaced by .asm */
+string Compilation::outputName(const string& filename)
+{
+	int i = filename.size();
+	while (i >= 0 && filename[i--] != '.' && filename[i] != '\\');
+	return filename.substr(0, (i == 0 ? filename.size() : i + 1)) + ".asm";
+}
+
+/*
+	a failed compilation leaves every error it reported and no assembly.
+	Anything else thrown, e.g. running out of memory, fails this
+	compilation alone
+*/
+bool Compilation::compile()
+{
+	assembly.clear();
+	errors.clear();
+	try
+	{
+		Scanner scanner(source, 0, source->size());
+		Preprocessor preprocessor(scanner, filename);
+		Parser parser(preprocessor, isPretokenized);
+		if (threads > 0)
+			parser.setParallel(threads);
+		stringstream out;
+		CodeGen generator(parser, out);
+		generator.generate();
+		assembly = out.str();
+	}
+	catch (DiagnosticsException& error)
+	{
+		errors = error.errors();
+	}
+	catch (CompilerException& error)
+	{
+		errors.push_back(error.text());
+	}
+	catch (exception& error)
+	{
+		errors.push_back(string("Internal Error: ") + error.what());
+	}
+	return errors.empty();
+}
@@ -0,0 +1,36 @@
+#ifndef COMPILATION_H
+#define COMPILATION_H
+#include "codeGen.h"
+
+/*
+	one translation unit from source text to assembly. Everything a
+	compilation changes is its own (source buffer, scanner, preprocessor,
+	parser with its arena and tables, code generator), so any number of
+	them can run at once on different threads
+*/
+class Compilation
+{
+private :
+
+	string filename, assembly;
+	Source_buffer* source;
+	vector<string> errors;
+	unsigned int threads;
+	bool isPretokenized;
+public :
+
+	Compilation(FILE* file, const string& name);
+	Compilation(const string& text, const string& name);
+	~Compilation();
+	void setPretokenized(){isPretokenized = true;}
+	void setParallel(unsigned int count){threads = count;}
+	void setFlags(const string& key);
+	bool compile();
+	const string& getAssembly() const {return assembly;}
+	const vector<string>& getErrors() const {return errors;}
+	string getOutput() const;
+
+	static string outputName(const string& filename);
+};
+
+#endif
@@ -27,3 +27,11 @@ string SemanticsException::text() const throw()
 	e += CompilerException::text();
 	return e;
 }
+
+string DiagnosticsException::text() const throw()
+{
+	string e;
+	for (size_t i = 0; i < _errors.size(); i++)
+		e += (i == 0 ? "" : "\n") + _errors[i];
+	return e;
+}
@@ -2,6 +2,7 @@
 #define EXCEPTIONS_H
 #include <string>
 #include <sstream>
+#include <vector>
 
 using namespace std;
 
@@ -46,6 +47,20 @@ public :
 	string text() const throw();
 };
 
+/* everything one parse reported, one error per line */
+class DiagnosticsException : public CompilerException
+{
+private :
+	vector<string> _errors;
+public :
+
+	DiagnosticsException(const vector<string>& errors) throw():
+        CompilerException(0, 0, string()), _errors(errors) {}
+    ~DiagnosticsException() throw() {}
+	string text() const throw();
+	const vector<string>& errors() const {return _errors;}
+};
+
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,861 @@
+#include "flatTree.h"
+#include "codeGen.h"
+
+#define DW(value) ("dword ptr " + value)
+#define QW(value) ("qword ptr " + value)
+#define OFFSET(value) ("offset " + value)
+#define ADR(value) ("[" + value + "]")
+#define RET(name) (name + "RetLabel")
+#define SHIFT(arr, shift) (arr.substr(0, arr.length() - 1) + " + " + shift + "]")
+#define isExprKind(kind) ((kind) < NODE_STMT)
+
+typedef struct
+{
+	unsigned int end;
+	size_t depth;
+	bool isCompound;
+}FrameT;
+
+/* a compound's symbols and closing brace are indented three columns past its prefix */
+static void closeCompound(size_t width)
+{
+	cout << string(width + 3, ' ') << "}" << endl;
+}
+
+void FlatTree::clear()
+{
+	kinds.clear();
+	tails.clear();
+	tokens.clear();
+	ends.clear();
+	refs.clear();
+	types.clear();
+	symbols.clear();
+	tables.clear();
+	pending.clear();
+}
+
+unsigned int FlatTree::add(NodeKindT kind, const Token& token, SymType* type, unsigned int ref, bool isTail)
+{
+	unsigned int i = kinds.size();
+	kinds.push_back(kind);
+	tails.push_back(isTail);
+	tokens.push_back(token);
+	ends.push_back(i + 1);
+	refs.push_back(ref);
+	types.push_back(type);
+	return i;
+}
+
+/* lists are cut the way the pointer printing cuts them: at the first NULL, keeping a non NULL last one */
+void FlatTree::addList(const vector<ExprNode*>& list)
+{
+	if (list.empty())
+		return;
+	for (size_t i = 0; i < list.size() - 1 && list[i] != NULL; i++)
+		addExpr(list[i], false);
+	if (list.back() != NULL)
+		addExpr(list.back(), true);
+}
+
+void FlatTree::addList(const vector<StmtNode*>& list)
+{
+	if (list.empty())
+		return;
+	for (size_t i = 0; i < list.size() - 1 && list[i] != NULL; i++)
+		addStmt(list[i], false);
+	if (list.back() != NULL)
+		addStmt(list.back(), true);
+}
+
+void FlatTree::addExpr(ExprNode* node, bool isTail)
+{
+	NodeKindT kind = node->getKind();
+	unsigned int ref = 0;
+	if (kind == NODE_VAR)
+	{
+		ref = symbols.size();
+		symbols.push_back(static_cast<ExprVar*>(node)->sym);
+	}
+	if (kind == NODE_FIELD_SELECT)
+		ref = static_cast<ExprFieldSelect*>(node)->field;
+	unsigned int i = add(kind, node->token, node->type, ref, isTail);
+	addList(node->children);
+	ends[i] = kinds.size();
+}
+
+/* a compound without a table still gets a slot, so refs[i] always names one */
+void FlatTree::addStmt(StmtNode* node, bool isTail)
+{
+	NodeKindT kind = node->getKind();
+	unsigned int ref = 0;
+	if (kind == NODE_COMPOUND)
+	{
+		ref = tables.size();
+		tables.push_back(node->getTable());
+		if (node->getTable() != NULL)
+			pending.push_back(node->getTable());
+	}
+	unsigned int i = add(kind, node->token, NULL, ref, isTail);
+	addList(node->expr);
+	addList(node->stmt);
+	ends[i] = kinds.size();
+}
+
+/* every initializer becomes a root of its own, so a compound's subtree stays one range */
+void FlatTree::addInitializers(SymbolTable* table)
+{
+	for (size_t i = 0; i < table->size(); i++)
+	{
+		Symbol* sym = table->at(i);
+		if (!sym->isVar())
+			continue;
+		SymVar* var = static_cast<SymVar*>(sym);
+		SyntaxNode* init = var->getInitializer();
+		unsigned int root = kinds.size();
+		if (ExprNode* expr = dynamic_cast<ExprNode*>(init))
+			addExpr(expr, true);
+		else if (StmtNode* stmt = dynamic_cast<StmtNode*>(init))
+			addStmt(stmt, true);
+		else
+			continue;
+		var->setFlat(this, root);
+	}
+}
+
+void FlatTree::flatten(SymbolTable* global)
+{
+	clear();
+	pending.push_back(global);
+	for (size_t i = 0; i < pending.size(); i++)
+		addInitializers(pending[i]);
+	pending.clear();
+}
+
+/*
+	same output as SyntaxNode::print and its overrides: the ancestors that
+	are still open are kept on a stack, the prefix of each depth is built
+	once in place, and a compound closes its brace once the scan leaves its
+	range
+*/
+void FlatTree::print(unsigned int root, string str, bool isTail) const
+{
+	vector<FrameT> open;
+	vector<string> prefixes(1, str);
+	for (unsigned int i = root; i < ends[root]; i++)
+	{
+		while (!open.empty() && open.back().end <= i)
+		{
+			if (open.back().isCompound)
+				closeCompound(prefixes[open.back().depth].size());
+			open.pop_back();
+		}
+		size_t depth = open.empty() ? 0 : open.back().depth + 1;
+		if (i != root)
+			isTail = tails[i] != 0;
+		if (prefixes.size() <= depth + 1)
+			prefixes.resize(depth + 2);
+		const string& prefix = prefixes[depth];
+		if (kinds[i] == NODE_CAST)
+		{
+			types[i]->print(prefix + " casted to ", false);
+			cout << endl;
+		}
+		else if (isExprKind(kinds[i]) && kinds[i] != NODE_IMPLICIT_CAST)
+		{
+			cout << prefix << (prefix.size() == 0 ? "-->" : "|__") << tokens[i].getSpelling() << "     ";
+			if (types[i] != NULL)
+				types[i]->print("", false);
+			cout << endl;
+		}
+		else if (!isExprKind(kinds[i]))
+		{
+			cout << prefix << (prefix.size() == 0 ? "-->" : "|__") << tokens[i].getSpelling() << " " << endl;
+			if (kinds[i] == NODE_COMPOUND && tables[refs[i]] != NULL)
+				tables[refs[i]]->print(string(prefix.size() + 7, ' '), true);
+		}
+		if (ends[i] > i + 1 || kinds[i] == NODE_COMPOUND)
+		{
+			prefixes[depth + 1].assign(prefix).append(isTail ? "    " : "|   ");
+			FrameT frame = {ends[i], depth, kinds[i] == NODE_COMPOUND};
+			open.push_back(frame);
+		}
+	}
+	for (; !open.empty(); open.pop_back())
+		if (open.back().isCompound)
+			closeCompound(prefixes[open.back().depth].size());
+}
+
+/*
+	code generation walks the same arrays: every expression leaves its
+	value on the stack (a double as 8 bytes, a record as its address), and
+	the children of node i are i + 1, ends[i + 1] and so on up to ends[i]
+*/
+
+static void compareOpDoubleGen(CodeGen& gen, CommandT opType)
+{
+	gen.addCommand(ASM_XOR, getReg(REG_ECX), getReg(REG_ECX));
+	gen.addCommand(ASM_COMISD, getReg(REG_XMM0), getReg(REG_XMM1));
+	gen.addCommand(opType, getReg(REG_CL));
+	gen.addCommand(ASM_PUSH, getReg(REG_ECX));
+}
+
+static void pushDouble(CodeGen& gen, string name)
+{
+	gen.shiftStack(-8);
+	gen.addCommand(ASM_SUB, getReg(REG_ESP), to_string(8));
+	gen.addCommand(ASM_MOVSD, getReg(REG_XMM0), name);
+	gen.addCommand(ASM_MOVSD, QW(ADR(getReg(REG_ESP))), getReg(REG_XMM0)); 
+}
+
+static void popDouble(CodeGen& gen)
+{
+	gen.shiftStack(8);
+	gen.addCommand(ASM_MOVSD, getReg(REG_XMM0), QW(ADR(getReg(REG_ESP))));
+	gen.addCommand(ASM_ADD, getReg(REG_ESP), to_string(8));
+}
+static void simpleOpIntGen(CodeGen& gen, CommandT opType)
+{
+	gen.addCommand(opType, getReg(REG_EAX), getReg(REG_EBX));
+	gen.addCommand(ASM_PUSH, getReg(REG_EAX));
+}
+
+static void divisionOpIntGen(CodeGen& gen, bool isMod = false)
+{
+	gen.addCommand(ASM_CDQ);
+	gen.addCommand(ASM_IDIV, getReg(REG_EBX));
+	gen.addCommand(ASM_PUSH, getReg(isMod ? REG_EDX : REG_EAX));
+}
+
+static void compareOpIntGen(CodeGen& gen, CommandT opType)
+{
+	gen.addCommand(ASM_XOR, getReg(REG_ECX), getReg(REG_ECX));
+	gen.addCommand(ASM_CMP, getReg(REG_EAX), getReg(REG_EBX));
+	gen.addCommand(opType, getReg(REG_CL));
+	gen.addCommand(ASM_PUSH, getReg(REG_ECX));
+}
+
+static void logIntGen(CodeGen& gen, CommandT cond, string label, RegT r)
+{
+	gen.addCommand(ASM_TEST, getReg(r), getReg(r));
+	gen.addCommand(cond, label);
+}
+
+static void logAndOrIntGen(CodeGen& gen, bool isAnd = true)
+{
+	string finishL = gen.genLabel(), falseL = gen.genLabel();
+	logIntGen(gen, (isAnd ? ASM_JZ : ASM_JNZ), falseL, REG_EAX);
+	logIntGen(gen, (isAnd ? ASM_JZ : ASM_JNZ), falseL, REG_EBX);
+
+	gen.addCommand(ASM_PUSH, string(isAnd ? "1" : "0") );
+	gen.addCommand(ASM_JMP, string(finishL));
+	gen.addLabel(string(falseL));
+	gen.addCommand(ASM_PUSH, string(isAnd ? "0" : "1"));
+	gen.addLabel(string(finishL));
+}
+
+static void simpleAssignment(CodeGen& gen)
+{
+	gen.addCommand(ASM_POP, getReg(REG_EBX));
+	gen.addCommand(ASM_POP, getReg(REG_EAX));
+	gen.addCommand(ASM_MOV, DW(ADR(getReg(REG_EAX))), getReg(REG_EBX));
+	gen.addCommand(ASM_PUSH, DW(ADR(getReg(REG_EAX))));
+}
+
+static void doubleAssignment(CodeGen& gen)
+{
+	popDouble(gen);
+	gen.addCommand(ASM_POP, getReg(REG_EAX));
+	gen.addCommand(ASM_MOVSD, QW(ADR(getReg(REG_EAX))), getReg(REG_XMM0));
+	pushDouble(gen, getReg(REG_XMM0));
+}
+
+static void simpleOpDoubleGen(CodeGen& gen, CommandT opType)
+{
+	gen.addCommand(opType, getReg(REG_XMM0), getReg(REG_XMM1));
+	pushDouble(gen, getReg(REG_XMM0));
+}
+
+static void binaryIntGen(CodeGen& gen, const Token& op)
+{
+	gen.addCommand(ASM_POP, getReg(REG_EBX));
+	gen.addCommand(ASM_POP, getReg(REG_EAX));
+
+	switch(op)
+	{
+	case OP_ADD : simpleOpIntGen(gen, ASM_ADD) ;break;
+	case OP_SUB : simpleOpIntGen(gen, ASM_SUB); break;
+	case OP_ASTERISK : simpleOpIntGen(gen, ASM_IMUL); break;
+
+	case OP_AMP : simpleOpIntGen(gen, ASM_AND); break;
+	case OP_BOR : simpleOpIntGen(gen, ASM_OR); break;
+	case OP_XOR : simpleOpIntGen(gen, ASM_XOR); break;
+
+	case OP_EQUAL : compareOpIntGen(gen, ASM_SETE); break;
+	case OP_UNEQUAL : compareOpIntGen(gen, ASM_SETNE); break;
+	case OP_LESS_OR_EQUAL : compareOpIntGen(gen, ASM_SETLE); break;
+	case OP_GREATER_OR_EQUAL : compareOpIntGen(gen, ASM_SETGE); break;
+	case OP_LESS : compareOpIntGen(gen, ASM_SETL); break;
+	case OP_GREATER : compareOpIntGen(gen, ASM_SETG); break;
+
+	case OP_DIV : divisionOpIntGen(gen); break;
+	case OP_MOD : divisionOpIntGen(gen, true); break;
+
+	case OP_AND : logAndOrIntGen(gen); break;
+	case OP_OR : logAndOrIntGen(gen, false);break;
+	}
+}
+
+static void binaryDoubleGen(CodeGen& gen, const Token& op)
+{
+	popDouble(gen);
+	gen.addCommand(ASM_MOVSD, getReg(REG_XMM1), getReg(REG_XMM0));
+	popDouble(gen);
+
+	switch(op)
+	{
+	case OP_ADD : simpleOpDoubleGen(gen, ASM_ADDSD) ;break;
+	case OP_SUB : simpleOpDoubleGen(gen, ASM_SUBSD); break;
+	case OP_ASTERISK : simpleOpDoubleGen(gen, ASM_MULSD); break;
+	case OP_DIV : simpleOpDoubleGen(gen, ASM_DIVSD); break;
+
+	case OP_AMP : simpleOpDoubleGen(gen, ASM_AND); break;
+	case OP_BOR : simpleOpDoubleGen(gen, ASM_OR); break;
+	case OP_XOR : simpleOpDoubleGen(gen, ASM_XOR); break;
+
+	case OP_EQUAL : compareOpDoubleGen(gen, ASM_SETE); break;
+	case OP_UNEQUAL : compareOpDoubleGen(gen, ASM_SETNE); break;
+	case OP_LESS_OR_EQUAL : compareOpDoubleGen(gen, ASM_SETBE); break;
+	case OP_GREATER_OR_EQUAL : compareOpDoubleGen(gen, ASM_SETAE); break;
+	case OP_LESS : compareOpDoubleGen(gen, ASM_SETB); break;
+	case OP_GREATER : compareOpDoubleGen(gen, ASM_SETA); break;
+	}
+}
+
+/* pointer is the type of the pointer operand */
+static void binaryPointerGen(CodeGen& gen, const Token& op, SymType* pointer, bool isPointerLeft)
+{
+	if (op == OP_ADD)
+	{
+		SymType* pType = static_cast<SymTypePointer*>(pointer)->dereference();
+		RegT left = isPointerLeft ? REG_EBX : REG_EAX, right = !isPointerLeft ? REG_EBX : REG_EAX;
+		gen.addCommand(ASM_POP, getReg(left));
+		gen.addCommand(ASM_POP, getReg(right));
+		gen.addCommand(ASM_IMUL, getReg(REG_EBX), to_string(pType->getSize()));
+		gen.addCommand(ASM_ADD, getReg(REG_EAX), getReg(REG_EBX));	
+	}
+	if (op == OP_SUB)
+	{
+		gen.addCommand(ASM_POP, getReg(REG_EBX));
+		gen.addCommand(ASM_POP, getReg(REG_EAX));
+		gen.addCommand(ASM_SUB, getReg(REG_EAX), getReg(REG_EBX));
+	}
+	gen.addCommand(ASM_PUSH, getReg(REG_EAX));
+}
+
+static void generateLvalue(CodeGen& gen, string name)
+{
+	gen.addCommand(ASM_LEA, getReg(REG_EAX), name);
+	gen.addCommand(ASM_PUSH, getReg(REG_EAX));
+}
+
+void FlatTree::genUnary(unsigned int i, CodeGen& gen) const
+{
+	unsigned int child = i + 1;
+	switch(tokens[i])
+	{
+
+	case OP_ASTERISK :
+		{
+			genExpr(child, gen);
+			gen.addCommand(ASM_POP, getReg(REG_EAX));
+
+			if (*types[i] == DOUBLE || *types[i] == FLOAT)
+				pushDouble(gen, QW(ADR(getReg(REG_EAX))));
+			else
+				gen.addCommand(ASM_PUSH, DW(ADR(getReg(REG_EAX))));
+		}break;
+	
+
+	case OP_AMP : genLvalue(child, gen); break;
+
+	case OP_INC : case OP_DEC :
+		{
+			genLvalue(child, gen);
+			gen.addCommand(ASM_POP, getReg(REG_EAX));
+			if (*types[i] == INT)
+			{
+				gen.addCommand(tokens[i] == OP_INC ? ASM_INC : ASM_DEC, DW(ADR(getReg(REG_EAX))));
+				gen.addCommand(ASM_PUSH, getReg(REG_EAX));
+			}
+			else
+			{
+				gen.addCommand(ASM_MOVSD,  getReg(REG_XMM0), QW(ADR(getReg(REG_EAX))));
+				gen.addCommand(tokens[i] == OP_INC ? ASM_ADDSD : ASM_SUBSD, getReg(REG_XMM0), getPrefix(to_string(1), PREFIX_DOUBLE_CONST));
+				gen.addCommand(ASM_MOVSD,  QW(ADR(getReg(REG_EAX))), getReg(REG_XMM0));
+				pushDouble(gen, getReg(REG_XMM0));
+			}
+		}break;
+
+	case OP_NOT :
+		{
+			genExpr(child, gen);
+			gen.addCommand(ASM_PUSH, to_string(0));
+			if (*types[child] == DOUBLE)
+			{
+				popDouble(gen);
+				compareOpDoubleGen(gen, ASM_SETE);
+			}
+			else	
+			{	
+				gen.addCommand(ASM_POP, getReg(REG_EAX));
+				compareOpIntGen(gen, ASM_SETE);
+			}
+		}break;
+	case OP_ADD : genExpr(child, gen);break;
+	case OP_SUB : 
+		{
+			if (*types[child] == DOUBLE)
+			{
+				pushDouble(gen, getPrefix(to_string(2), PREFIX_DOUBLE_CONST));
+				genExpr(child, gen);
+				popDouble(gen);
+				gen.addCommand(ASM_MOVSD, getReg(REG_XMM1), getReg(REG_XMM0));
+				popDouble(gen);
+				simpleOpDoubleGen(gen, ASM_SUBSD);
+			}
+			else
+			{
+				gen.addCommand(ASM_POP, getReg(REG_EAX));
+				gen.addCommand(ASM_NEG, getReg(REG_EAX));
+				gen.addCommand(ASM_PUSH, getReg(REG_EAX));
+			}
+		}
+	}
+}
+
+void FlatTree::genBinary(unsigned int i, CodeGen& gen) const
+{
+	unsigned int left = i + 1, right = ends[left];
+	genExpr(left, gen);
+	genExpr(right, gen);
+	
+#define isType(type) *types[left] == type || *types[right] == type
+
+	if (isType(POINTER))
+	{
+		bool isPointerLeft = *types[left] == POINTER;
+		binaryPointerGen(gen, tokens[i], types[isPointerLeft ? left : right], isPointerLeft);
+		return;
+	}
+	if (isType(DOUBLE) && !isLogic(tokens[i]))
+		binaryDoubleGen(gen, tokens[i]);
+	if (isType(INT))
+		binaryIntGen(gen, tokens[i]);
+	
+#undef isType
+}
+
+/* the arguments are pushed from the last one; the first child is the function */
+void FlatTree::genFuncCall(unsigned int i, CodeGen& gen) const
+{
+	SymTypeFunc* func = static_cast<SymTypeFunc*>(types[i + 1]);
+	vector<unsigned int> args;
+	for (unsigned int arg = ends[i + 1]; arg < ends[i]; arg = ends[arg])
+		args.push_back(arg);
+
+	size_t size = 0, rshift = func->dereference()->getSize();
+	gen.addCommand(ASM_SUB, getReg(REG_ESP), to_string(rshift));
+	gen.shiftStack(-rshift);
+
+	for (int j = args.size() - 1; j >= 0; j--)
+	{
+		genExpr(args[j], gen);
+		size += types[args[j]]->getSize();
+	}
+	
+	gen.addCommand(ASM_CALL, func->getVarAsmName());
+	gen.shiftStack(size);
+	gen.addCommand(ASM_ADD, getReg(REG_ESP), to_string(size));
+}
+
+/* shift is where the list starts in its array, a nested list gets its own */
+void FlatTree::genInitList(unsigned int i, CodeGen& gen, int shift) const
+{
+	SymTypeArray* array = static_cast<SymTypeArray*>(types[i]);
+	int prev = 0;
+	for (unsigned int x = i + 1; x < ends[i]; x = ends[x])
+	{
+		if (prev != 0)
+			shift += prev;
+		prev = types[x]->getSize();
+		if (*types[x] == ARRAY)
+			genInitList(x, gen, shift);
+		else
+		{
+			if(array->isGlobal())
+			{
+				if (array->dereference()->getSize() == 4)
+					gen.addDD(string(), SyntaxNode::getValue(tokens[x], 0), 4);
+				else
+					gen.addDQ(string(), SyntaxNode::getValue(tokens[x], 2), 8);
+			}
+			else
+			{
+				if (types[x]->getSize() == 4)
+					gen.addCommand(ASM_MOV, DW(SHIFT(array->getVarAsmName(), to_string(shift))), SyntaxNode::getValue(tokens[x], 0));
+				else
+				{
+					gen.addCommand(ASM_MOVSD, getReg(REG_XMM0), QW(SyntaxNode::getValue(tokens[x], 2)));
+					gen.addCommand(ASM_MOVSD, QW(SHIFT(array->getVarAsmName(), to_string(shift))), getReg(REG_XMM0));
+				}
+
+			}
+		}
+	}
+}
+
+/*
+	the memory operand disp bytes into the record node i yields: a named
+	record needs no register at all, the offsets of nested members add up
+	at compile time, and any other record's address is left in eax
+*/
+string FlatTree::genOperand(unsigned int i, CodeGen& gen, unsigned int disp) const
+{
+	if (kinds[i] == NODE_VAR)
+	{
+		Symbol* sym = symbols[refs[i]];
+		const string& name = static_cast<SymVar*>(sym)->getAsmName();
+		if (disp == 0)
+			return name;
+		return sym->isGlobal() ? ADR(name + " + " + to_string(disp)) : SHIFT(name, to_string(disp));
+	}
+	if (kinds[i] == NODE_FIELD_SELECT)
+	{
+		disp += static_cast<SymTypeRecord*>(types[i + 1])->getOffset(refs[i]);
+		return genOperand(i + 1, gen, disp);
+	}
+	genExpr(i, gen);
+	gen.addCommand(ASM_POP, getReg(REG_EAX));
+	return ADR(getReg(REG_EAX) + (disp != 0 ? " + " + to_string(disp) : string()));
+}
+
+void FlatTree::genLvalue(unsigned int i, CodeGen& gen) const
+{
+	switch(kinds[i])
+	{
+	case NODE_VAR :
+		{
+			Symbol* sym = symbols[refs[i]];
+			if (sym->isGlobal())
+				gen.addCommand(ASM_PUSH, OFFSET(static_cast<SymVar*>(sym)->getAsmName()));
+			else
+				generateLvalue(gen, static_cast<SymVar*>(sym)->getAsmName());
+		}break;
+
+	case NODE_UNARY : genExpr(i + 1, gen); break;
+
+	case NODE_INDEXING :
+		{
+			genExpr(i + 1, gen);
+			genExpr(ends[i + 1], gen);
+			binaryPointerGen(gen, Token(OP_ADD), types[i + 1], true);
+		}break;
+
+	case NODE_FIELD_SELECT :
+		{
+			string operand = genOperand(i, gen, 0);
+			if (operand != ADR(getReg(REG_EAX)))
+				gen.addCommand(ASM_LEA, getReg(REG_EAX), operand);
+			gen.addCommand(ASM_PUSH, getReg(REG_EAX));
+		}break;
+	}
+}
+
+void FlatTree::genExpr(unsigned int i, CodeGen& gen) const
+{
+	unsigned int child = i + 1;
+	switch(kinds[i])
+	{
+	case NODE_VAR :
+		{
+			const string& name = static_cast<SymVar*>(symbols[refs[i]])->getAsmName();
+			if (*types[i] == INT || *types[i] == FLOAT)
+				gen.addCommand(ASM_PUSH, DW(name));
+			else if (*types[i] == DOUBLE)
+				pushDouble(gen, QW(name));
+			else if (*types[i] == POINTER)
+			{
+				gen.addCommand(ASM_MOV, getReg(REG_EAX), DW(name));//tmp for int
+				gen.addCommand(ASM_PUSH, getReg(REG_EAX));
+			}
+			else
+				genLvalue(i, gen);
+		}break;
+
+	case NODE_CONST : gen.addCommand(ASM_PUSH, SyntaxNode::getValue(tokens[i], 0)); break;
+
+	case NODE_DOUBLE_CONST :
+		{
+			string name, value = SyntaxNode::getValue(tokens[i], 2);
+			if (!gen.hasConst(DOUBLE, value))
+			{
+				gen.insertConst(DOUBLE, value);
+				name = getPrefix(to_string(gen.getConstCount(DOUBLE)), PREFIX_DOUBLE_CONST);
+				gen.addDQ(name, value, 8);
+			}
+			else
+				name = gen.getConst(DOUBLE, value);
+			pushDouble(gen, QW(name));
+		}break;
+
+	case NODE_STRING_CONST : gen.addCommand(ASM_PUSH, OFFSET(gen.getStringConst(tokens[i].val.strId))); break;
+
+	case NODE_UNARY : genUnary(i, gen); break;
+
+	case NODE_POSTFIX :
+		{
+			genLvalue(child, gen);
+			gen.addCommand(ASM_POP, getReg(REG_EAX));
+			if (*types[i] == INT)
+			{
+				gen.addCommand(ASM_MOV, getReg(REG_EBX), DW(ADR(getReg(REG_EAX)))); 
+				gen.addCommand(tokens[i] == OP_INC ? ASM_INC : ASM_DEC, DW(ADR(getReg(REG_EAX))));
+				gen.addCommand(ASM_PUSH, getReg(REG_EBX));
+			}
+			else
+			{
+				gen.addCommand(ASM_MOVSD, getReg(REG_XMM1), QW(ADR(getReg(REG_EAX)))); 
+				gen.addCommand(ASM_MOVSD,  getReg(REG_XMM0), QW(ADR(getReg(REG_EAX))));
+				gen.addCommand(tokens[i] == OP_INC ? ASM_ADDSD : ASM_SUBSD, getReg(REG_XMM0), getPrefix(to_string(1), PREFIX_DOUBLE_CONST));
+				gen.addCommand(ASM_MOVSD,  QW(ADR(getReg(REG_EAX))), getReg(REG_XMM0));
+				pushDouble(gen, getReg(REG_XMM1));
+			}
+		}break;
+
+	case NODE_IMPLICIT_CAST : genExpr(child, gen); break;
+
+	case NODE_CAST :
+		{
+			genExpr(child, gen);
+			if (*types[i] == INT)
+			{
+				popDouble(gen);
+				gen.addCommand(ASM_CVTTSD2SI, getReg(REG_EAX), getReg(REG_XMM0));
+				gen.addCommand(ASM_PUSH, getReg(REG_EAX));
+			}
+			if (*types[i] == DOUBLE && *types[child] == INT)
+			{
+				gen.addCommand(ASM_POP, getReg(REG_EAX));
+				gen.addCommand(ASM_CVTSI2SD, getReg(REG_XMM0), getReg(REG_EAX));
+				pushDouble(gen, getReg(REG_XMM0));
+			}
+		}break;
+
+	case NODE_BINARY : genBinary(i, gen); break;
+
+	case NODE_TERNARY :
+		{
+			string end = gen.genLabel(), rightCond = gen.genLabel();
+			unsigned int right = ends[child];
+
+			genExpr(child, gen);
+			gen.addCommand(ASM_POP, getReg(REG_ECX));
+			gen.addCommand(ASM_JZ, rightCond);
+			genExpr(right, gen);
+			gen.addCommand(ASM_JMP, end);
+			gen.addLabel(rightCond);
+			genExpr(ends[right], gen);
+			gen.addLabel(end);
+		}break;
+
+	case NODE_FUNC_CALL : genFuncCall(i, gen); break;
+
+	case NODE_ASSIGNMENT :
+		{
+			if (*types[child] != ARRAY)
+				genLvalue(child, gen);
+			genExpr(ends[child], gen);
+			if (*types[child] == DOUBLE)
+				doubleAssignment(gen);
+			if (*types[child] == INT || *types[child] == POINTER)
+				simpleAssignment(gen);
+		}break;
+
+	case NODE_INDEXING :
+		{
+			genLvalue(i, gen);
+			gen.addCommand(ASM_POP, getReg(REG_EAX));
+
+			if (*types[i] == DOUBLE || *types[i] == FLOAT)
+				pushDouble(gen, QW(ADR(getReg(REG_EAX))));
+			else
+			if (*types[i] == INT || *types[i] == POINTER)
+				gen.addCommand(ASM_PUSH, DW(ADR(getReg(REG_EAX))));
+			else
+				gen.addCommand(ASM_PUSH, getReg(REG_EAX));
+		}break;
+
+	/* a member that is itself a record or an array yields its address */
+	case NODE_FIELD_SELECT :
+		{
+			if (*types[i] == DOUBLE)
+				pushDouble(gen, QW(genOperand(i, gen, 0)));
+			else
+			if (*types[i] == INT || *types[i] == POINTER)
+				gen.addCommand(ASM_PUSH, DW(genOperand(i, gen, 0)));
+			else
+				genLvalue(i, gen);
+		}break;
+
+	case NODE_INIT_LIST : genInitList(i, gen, 0); break;
+	}
+}
+
+void FlatTree::genJump(unsigned int i, CodeGen& gen) const
+{
+	switch(tokens[i])
+	{
+	case KW_RETURN :
+		{
+			/* the child is the statement of the returned expression, which may have none */
+			unsigned int value = i + 2;
+			SymType* type = value < ends[i] && types[value] != NULL ? types[value] : _void;
+			if (*type != VOID)
+			{
+				gen.addCommand(ASM_LEA, getReg(REG_EAX), string("func_ret[ebp]"));
+				gen.addCommand(ASM_PUSH, getReg(REG_EAX));
+				genExpr(value, gen);
+				if (*type == INT)
+					simpleAssignment(gen);
+
+				if (*type == DOUBLE)
+					doubleAssignment(gen);
+			}			
+			gen.restoreStack();
+			gen.addEoln(1);
+			gen.addCommand(ASM_JMP, RET(gen.getLastFunction()));
+		}break;
+
+	case KW_BREAK : gen.addCommand(ASM_JMP, gen.getJumpBreak()); break;
+
+	default : gen.addCommand(ASM_JMP, gen.getJumpContinue()); break;
+
+	}
+	gen.restoreStack();
+	gen.addEoln(1);
+}
+
+/* for (e1; e2; e) body keeps e ahead of its statements, and a missing e leaves three children */
+void FlatTree::genFor(unsigned int i, CodeGen& gen) const
+{
+	unsigned int step = i + 1, e1 = step;
+	if (isExprKind(kinds[step]))
+		e1 = ends[step];
+	unsigned int e2 = ends[e1], body = ends[e2];
+
+	string cond = gen.genLabel() + "cond", end = gen.genLabel() + "end", start = gen.genLabel() + "start";
+	gen.pushJumps(start, end);
+	genStmt(e1, gen);
+	gen.addCommand(ASM_JMP, cond);
+	gen.addLabel(start);
+	if (step != e1)
+		genExpr(step, gen);
+	gen.restoreStack();
+
+	gen.addLabel(cond);
+	if (e2 + 1 < body)
+	{
+		genExpr(e2 + 1, gen);
+		gen.addCommand(ASM_POP, getReg(REG_ECX));
+		gen.addCommand(ASM_CMP, getReg(REG_ECX), to_string(0));
+		gen.addCommand(ASM_JZ, end);
+	}
+
+	genStmt(body, gen);
+	gen.addCommand(ASM_JMP, start);
+	gen.addLabel(end);
+	gen.popJumps();
+}
+
+void FlatTree::genStmt(unsigned int i, CodeGen& gen) const
+{
+	unsigned int child = i + 1;
+	switch(kinds[i])
+	{
+	case NODE_EXPR_STMT :
+		for (; child < ends[i]; child = ends[child])
+			genExpr(child, gen);
+		gen.restoreStack();
+		gen.addEoln(1);
+		break;
+
+	case NODE_STMT :
+		gen.restoreStack();
+		gen.addEoln(1);
+		break;
+
+	case NODE_COMPOUND :
+		for (; child < ends[i]; child = ends[child])
+			genStmt(child, gen);
+		break;
+
+	case NODE_SELECTION :
+		{
+			string lElse = gen.genLabel() + "else", lEnd = gen.genLabel()  + "end";
+			unsigned int ifBody = ends[child], elseBody = ends[ifBody];
+			genExpr(child, gen);
+			gen.addCommand(ASM_POP, getReg(REG_ECX));
+			gen.addCommand(ASM_CMP, getReg(REG_ECX), to_string(0));
+			gen.addCommand(ASM_JZ,  lElse);
+			genStmt(ifBody, gen);
+			gen.addCommand(ASM_JMP, lEnd);
+			gen.addLabel(lElse);
+			if (elseBody < ends[i])
+				genStmt(elseBody, gen);
+			gen.addLabel(lEnd);
+		}break;
+
+	case NODE_WHILE :
+		{
+			string lWhile = gen.genLabel() + "while", lendWhile = gen.genLabel()  + "endWhile";
+			gen.pushJumps(lWhile, lendWhile);
+			gen.addLabel(lWhile);
+			genExpr(child, gen);
+			gen.addCommand(ASM_POP, getReg(REG_ECX));
+			gen.addCommand(ASM_CMP, getReg(REG_ECX), to_string(0));
+			gen.addCommand(ASM_JZ,  lendWhile);
+			genStmt(ends[child], gen);
+			gen.addCommand(ASM_JMP, lWhile);
+			gen.addLabel(lendWhile);
+			gen.popJumps();
+		}break;
+
+	/* the condition is the expression of the second statement */
+	case NODE_DO :
+		{
+			string lDo = gen.genLabel() + "do", lEnd = gen.genLabel() + "endDo";
+			gen.pushJumps(lDo, lEnd);
+			gen.addLabel(lDo);
+			genStmt(child, gen);
+			genExpr(ends[child] + 1, gen);
+			gen.addCommand(ASM_POP, getReg(REG_ECX));
+			gen.addCommand(ASM_CMP, getReg(REG_ECX), to_string(0));
+			gen.addCommand(ASM_JNZ,  lDo);
+			gen.addLabel(lEnd);
+			gen.popJumps();
+		}break;
+
+	case NODE_FOR : genFor(i, gen); break;
+
+	case NODE_JUMP : genJump(i, gen); break;
+	}
+}
+
+void FlatTree::gen(unsigned int root, CodeGen& gen) const
+{
+	if (isExprKind(kinds[root]))
+		genExpr(root, gen);
+	else
+		genStmt(root, gen);
+}
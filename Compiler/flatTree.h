@@ -0,0 +1,56 @@
+#ifndef FLATTREE_H
+#define FLATTREE_H
+#include "node.h"
+
+class CodeGen;
+
+/*
+	struct of arrays copy of the syntax trees, addressed by 32 bit indices.
+	Nodes are stored in preorder, so the subtree of node i is [i, ends[i])
+	and its first child is i + 1: a walk is a forward scan over a few
+	arrays instead of chasing pointers through virtual calls. The printer
+	and the code generator walk this copy; the parser, the type checks and
+	the folding still work on the node pointers, and the frame layout of a
+	function still walks its scopes' symbol tables
+*/
+class FlatTree
+{
+private :
+
+	vector<unsigned char> kinds, tails;
+	/* refs[i] is a variable's index in symbols, a compound's in tables, or a selected field's number */
+	vector<unsigned int> ends, refs;
+	vector<Token> tokens;
+	vector<SymType*> types;
+	vector<Symbol*> symbols;
+	vector<SymbolTable*> tables, pending;
+
+	unsigned int add(NodeKindT kind, const Token& token, SymType* type, unsigned int ref, bool isTail);
+	void addExpr(ExprNode* node, bool isTail);
+	void addStmt(StmtNode* node, bool isTail);
+	void addList(const vector<ExprNode*>& list);
+	void addList(const vector<StmtNode*>& list);
+	void addInitializers(SymbolTable* table);
+	void genExpr(unsigned int i, CodeGen& gen) const;
+	void genLvalue(unsigned int i, CodeGen& gen) const;
+	string genOperand(unsigned int i, CodeGen& gen, unsigned int disp) const;
+	void genUnary(unsigned int i, CodeGen& gen) const;
+	void genBinary(unsigned int i, CodeGen& gen) const;
+	void genFuncCall(unsigned int i, CodeGen& gen) const;
+	void genInitList(unsigned int i, CodeGen& gen, int shift) const;
+	void genStmt(unsigned int i, CodeGen& gen) const;
+	void genJump(unsigned int i, CodeGen& gen) const;
+	void genFor(unsigned int i, CodeGen& gen) const;
+public :
+
+	void clear();
+	void flatten(SymbolTable* table);
+	void print(unsigned int root, string str, bool isTail) const;
+	void gen(unsigned int root, CodeGen& gen) const;
+	size_t size() const {return kinds.size();}
+	NodeKindT getKind(unsigned int i) const {return (NodeKindT)kinds[i];}
+	unsigned int getEnd(unsigned int i) const {return ends[i];}
+	SymType* getType(unsigned int i) const {return types[i];}
+};
+
+#endif
@@ -0,0 +1,123 @@
+#include "intern.h"
+#include <string.h>
+#include <mutex>
+#include <stdexcept>
+#include <algorithm>
+
+#define CHUNK_BITS 12
+#define CHUNK_SIZE (1 << CHUNK_BITS)
+#define MAX_CHUNKS 4096
+
+/*
+	texts are kept in fixed size chunks that never move, so internedText
+	can read without taking the lock; slots is an open addressing table
+	of id + 1 (0 is an empty slot). Everything here is plain data so the
+	pool works during static initialization of other files
+*/
+static string* chunks[MAX_CHUNKS];
+static unsigned int* slots;
+static size_t slotCount;
+static unsigned int textCount;
+static InternStatsT stats;
+static mutex poolLock;
+
+static __inline unsigned int hashText(const char* s, size_t length)
+{
+	unsigned int h = 2166136261u;
+	for (size_t i = 0; i < length; i++)
+		h = (h ^ (unsigned char)s[i]) * 16777619u;
+	return h;
+}
+
+static void placeSlot(unsigned int id)
+{
+	const string& text = internedText(id);
+	size_t mask = slotCount - 1, h = hashText(text.data(), text.size()) & mask;
+	while (slots[h] != 0)
+		h = (h + 1) & mask;
+	slots[h] = id + 1;
+}
+
+static void rehash()
+{
+	unsigned int* old = slots;
+	size_t oldCount = slotCount;
+	slotCount = oldCount == 0 ? 1024 : oldCount * 2;
+	slots = new unsigned int[slotCount]();
+	for (size_t i = 0; i < oldCount; i++)
+		if (old[i] != 0)
+			placeSlot(old[i] - 1);
+	delete[] old;
+}
+
+unsigned int intern(const char* s, size_t length)
+{
+	lock_guard<mutex> guard(poolLock);
+	if (textCount * 2 >= slotCount)
+		rehash();
+	size_t mask = slotCount - 1, h = hashText(s, length) & mask;
+	for (; slots[h] != 0; h = (h + 1) & mask)
+	{
+		const string& text = internedText(slots[h] - 1);
+		if (text.size() == length && memcmp(text.data(), s, length) == 0)
+		{
+			++stats.hits;
+			return slots[h] - 1;
+		}
+	}
+	if (textCount == MAX_CHUNKS * CHUNK_SIZE)
+		throw length_error("identifier pool is full");
+	unsigned int id = textCount++;
+	if (chunks[id >> CHUNK_BITS] == NULL)
+		chunks[id >> CHUNK_BITS] = new string[CHUNK_SIZE];
+	chunks[id >> CHUNK_BITS][id & (CHUNK_SIZE - 1)].assign(s, length);
+	slots[h] = id + 1;
+	++stats.misses;
+	stats.bytes += length + 1;
+	return id;
+}
+
+unsigned int intern(const string& s)
+{
+	return intern(s.data(), s.size());
+}
+
+const string& internedText(unsigned int id)
+{
+	return chunks[id >> CHUNK_BITS][id & (CHUNK_SIZE - 1)];
+}
+
+InternStatsT getInternStats()
+{
+	lock_guard<mutex> guard(poolLock);
+	return stats;
+}
+
+unsigned int internMark()
+{
+	lock_guard<mutex> guard(poolLock);
+	return textCount;
+}
+
+/* forgets every spelling interned since mark: nothing may hold one of their ids or texts any more */
+void internRelease(unsigned int mark)
+{
+	lock_guard<mutex> guard(poolLock);
+	if (mark >= textCount)
+		return;
+	for (unsigned int id = mark; id < textCount; id++)
+	{
+		string& text = chunks[id >> CHUNK_BITS][id & (CHUNK_SIZE - 1)];
+		stats.bytes -= text.size() + 1;
+		string().swap(text);
+	}
+	for (unsigned int i = (mark + CHUNK_SIZE - 1) >> CHUNK_BITS; i <= (textCount - 1) >> CHUNK_BITS; i++)
+	{
+		delete[] chunks[i];
+		chunks[i] = NULL;
+	}
+	textCount = mark;
+	fill(slots, slots + slotCount, 0);
+	for (unsigned int id = 0; id < textCount; id++)
+		placeSlot(id);
+}
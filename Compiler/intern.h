@@ -0,0 +1,27 @@
+#ifndef INTERN_H
+#define INTERN_H
+#include <string>
+
+using namespace std;
+
+typedef struct
+{
+	unsigned long hits, misses, bytes;
+}InternStatsT;
+
+/*
+	process wide string pool: every distinct spelling gets a small id that
+	stays valid (and keeps its text at the same address) until exit, or
+	until the pool is released back to a mark taken before it. The pool
+	holds 16M spellings, past that intern throws length_error. --serve
+	releases what its compilations added whenever none is running; watch
+	mode keeps its one parse and only grows by the spellings edits add
+*/
+extern unsigned int intern(const char* s, size_t length);
+extern unsigned int intern(const string& s);
+extern const string& internedText(unsigned int id);
+extern InternStatsT getInternStats();
+extern unsigned int internMark();
+extern void internRelease(unsigned int mark);
+
+#endif
@@ -1,16 +1,26 @@
 //#include "codeGen.h"
 #include <string.h>
 #include <stdlib.h>
-#include "codeGen.h"
+#include <chrono>
+#include <thread>
+#include <sstream>
+#include "compilation.h"
+#include "intern.h"
+#include "watch.h"
+#include "preprocessor.h"
+#include "server.h"
 
 #define EXIT_FAILURE 1
 #define EXIT_SUCCESS 0
+#define BENCH_PASSES 10
 
 typedef enum
 {
 	SCAN,
 	PARSE,
 	GEN,
+	BENCH,
+	WATCH,
 }KeyT;
 
 KeyT getKey(char* k)
@@ -25,16 +35,251 @@ KeyT getKey(char* k)
 		case 's' : return PARSE;
 		case 'l' : return SCAN;
 		case 'g' : return GEN;
+		case 'b' : return BENCH;
+		case 'w' : return WATCH;
 	}
 	cout << "There is not such command" << endl;
 	exit(EXIT_FAILURE);
 }
 
+bool isPretokenized(char* k)
+{
+	return strlen(k) > 2 && k[2] == 't';
+}
+
+bool isFlat(char* k)
+{
+	return strlen(k) > 2 && strchr(k + 2, 'f') != NULL;
+}
+
+bool isParallel(char* k)
+{
+	return strlen(k) > 2 && strchr(k + 2, 'p') != NULL;
+}
+
+unsigned int parseThreads()
+{
+	return max(1u, thread::hardware_concurrency());
+}
+
+double wallSeconds()
+{
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void printBench(const string& phase, long tokens, double start)
+{
+	double seconds = wallSeconds() - start;
+	cout << phase << " tokens : " << tokens << endl;
+	cout << phase << " time : " << seconds << " s" << endl;
+	cout << phase << " tokens/sec : " << (seconds > 0 ? tokens / seconds : 0) << endl;
+}
+
+void printRate(const string& name, unsigned long hits, unsigned long total)
+{
+	cout << name << " hit rate : " << (total > 0 ? 100.0 * hits / total : 0) << " % (" << hits << " of " << total << ")" << endl;
+}
+
+void benchScanner(FILE* file, const string& filename)
+{
+	long tokens = 0;
+	double start = wallSeconds();
+	for (int i = 0; i < BENCH_PASSES; i++)
+	{
+		rewind(file);
+		Scanner scanner(file);
+		while (scanner.next() != EOF_TOKEN)
+			++tokens;
+	}
+	printBench("next", tokens, start);
+
+	vector<Token> buffer;
+	tokens = 0;
+	start = wallSeconds();
+	for (int i = 0; i < BENCH_PASSES; i++)
+	{
+		rewind(file);
+		Scanner scanner(file);
+		buffer.clear();
+		scanner.tokenize(buffer, 1);
+		tokens += buffer.size() - 1;
+	}
+	printBench("tokenize", tokens, start);
+
+	unsigned int threads = thread::hardware_concurrency();
+	vector<Token> parallel;
+	tokens = 0;
+	start = wallSeconds();
+	for (int i = 0; i < BENCH_PASSES; i++)
+	{
+		rewind(file);
+		Scanner scanner(file);
+		parallel.clear();
+		scanner.tokenize(parallel, threads == 0 ? 1 : threads);
+		tokens += parallel.size() - 1;
+	}
+	printBench("parallel", tokens, start);
+	bool isSame = parallel.size() == buffer.size() && memcmp(&parallel[0], &buffer[0], buffer.size() * sizeof(Token)) == 0;
+	cout << "parallel threads : " << threads << endl;
+	cout << "parallel matches serial : " << (isSame ? "yes" : "no") << endl;
+
+	vector<Token> preprocessed;
+	tokens = 0;
+	start = wallSeconds();
+	for (int i = 0; i < BENCH_PASSES; i++)
+	{
+		rewind(file);
+		Scanner scanner(file);
+		Preprocessor preprocessor(scanner, filename);
+		preprocessed.clear();
+		preprocessor.tokenize(preprocessed);
+		tokens += preprocessed.size() - 1;
+	}
+	printBench("preprocess", tokens, start);
+	PreprocessorStatsT files = getPreprocessorStats();
+	printRate("include cache", files.includes - files.mappedFiles, files.includes);
+	printRate("include guard", files.guardSkips, files.includes);
+	cout << "include files lexed : " << files.lexedFiles << endl;
+	printRate("macro cache", files.expansionHits, files.expansions);
+
+	InternStatsT stats = getInternStats();
+	cout << "intern hits : " << stats.hits << endl;
+	cout << "intern misses : " << stats.misses << endl;
+	cout << "intern pool bytes : " << stats.bytes << endl;
+}
+
+class NullBuffer : public streambuf
+{
+protected :
+
+	int overflow(int c){return c;}
+	streamsize xsputn(const char*, streamsize n){return n;}
+};
+
+string printed(Parser& parser)
+{
+	stringstream out;
+	streambuf* saved = cout.rdbuf(out.rdbuf());
+	parser.printTree();
+	cout.rdbuf(saved);
+	return out.str();
+}
+
+double benchPrint(Parser& parser)
+{
+	NullBuffer null;
+	streambuf* saved = cout.rdbuf(&null);
+	double start = wallSeconds();
+	for (int i = 0; i < BENCH_PASSES; i++)
+		parser.printTree();
+	cout.rdbuf(saved);
+	return wallSeconds() - start;
+}
+
+/* the same tree is printed through the node pointers and through its flattened copy */
+void benchTree(FILE* file, const string& filename)
+{
+	rewind(file);
+	Scanner scanner(file);
+	Preprocessor preprocessor(scanner, filename);
+	Parser parser(preprocessor);
+	try
+	{
+		double start = wallSeconds();
+		parser.parse();
+		cout << "parse time : " << wallSeconds() - start << " s" << endl;
+		double pointers = benchPrint(parser);
+		start = wallSeconds();
+		parser.flatten();
+		cout << "flatten time : " << wallSeconds() - start << " s" << endl;
+		double flat = benchPrint(parser);
+		cout << "tree nodes : " << parser.getFlatSize() << endl;
+		cout << "pointer tree print time : " << pointers << " s" << endl;
+		cout << "flat tree print time : " << flat << " s" << endl;
+
+		rewind(file);
+		Scanner again(file);
+		Preprocessor source(again, filename);
+		Parser parallel(source);
+		parallel.setParallel(parseThreads());
+		start = wallSeconds();
+		parallel.parse();
+		cout << "parallel parse time : " << wallSeconds() - start << " s" << endl;
+		cout << "parallel parse threads : " << parseThreads() << endl;
+		cout << "parallel parse matches serial : " << (printed(parallel) == printed(parser) ? "yes" : "no") << endl;
+	}
+	catch (CompilerException& error)
+	{
+		cout << "tree : " << error.text() << endl;
+	}
+}
+
+/* the assembly, or every error the compilation reported, goes to <name>.asm */
+void compileFile(FILE* file, char* filename, char* key)
+{
+	Compilation compilation(file, filename);
+	compilation.setFlags(key);
+	compilation.compile();
+	ofstream out(Compilation::outputName(filename).c_str());
+	out << compilation.getOutput();
+}
+
+/* the socket named by COMPILER_SOCKET, or DEFAULT_SOCKET */
+string serverSocket()
+{
+	const char* path = getenv("COMPILER_SOCKET");
+	return path != NULL ? path : DEFAULT_SOCKET;
+}
+
+/*
+	--client -g <file>... behaves like -g on each file, but the files are
+	compiled by a running --serve; with no server they are compiled here
+*/
+int runClient(int argc, char* argv[])
+{
+	if (argc < 4 || getKey(argv[2]) != GEN)
+	{
+		cout << "Usage : compiler --client -g <filename>..." << endl;
+		return EXIT_FAILURE;
+	}
+	vector<string> files(argv + 3, argv + argc);
+	CompileClient client(serverSocket());
+	if (client.run(argv[2], files))
+		return EXIT_SUCCESS;
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		FILE* file = fopen(files[i].c_str(), "r");
+		if (file == NULL)
+		{
+			fprintf(stderr, "Cannot open file");
+			continue;
+		}
+		compileFile(file, argv[i + 3], argv[2]);
+		fclose(file);
+	}
+	return EXIT_SUCCESS;
+}
+
 int main(int argc ,char* argv[])
 {	
 	FILE *file;
 	char* filename;
 	string outStream;
+	if (argc >= 2 && strcmp(argv[1], "--serve") == 0)
+	{
+		try
+		{
+			CompileServer server(argc > 2 ? argv[2] : serverSocket());
+			server.run();
+		}
+		catch (runtime_error& error)
+		{
+			fprintf(stderr, "%s\n", error.what());
+			return EXIT_FAILURE;
+		}
+	}
+	if (argc >= 2 && strcmp(argv[1], "--client") == 0)
+		return runClient(argc, argv);
 	if (argc < 2)
 	{
 		cout << "C compiler by Alexander D. Petrov  C8303a"<< endl;
@@ -49,32 +294,46 @@ int main(int argc ,char* argv[])
 			fprintf(stderr, "Cannot open file");
 			return EXIT_FAILURE;
 		}  
+		if (getKey(argv[1]) == GEN)
+		{
+			compileFile(file, filename, argv[1]);
+			fclose(file);
+			return EXIT_SUCCESS;
+		}
 		try
 		{
 			Scanner scanner(file);
-			Parser parser(scanner);
+			Preprocessor preprocessor(scanner, filename);
+			Parser parser(preprocessor, isPretokenized(argv[1]));
+			if (isParallel(argv[1]))
+				parser.setParallel(parseThreads());
 
 			switch(getKey(argv[1]))
 			{
 				case SCAN : 
+				{
+					SourceScope scope(scanner.getSource());
 					while (scanner.currToken != EOF_TOKEN)
 						cout << scanner.next() << endl;
+				}break;
+				case BENCH :
+					benchScanner(file, filename);
+					benchTree(file, filename);
 					break;
+				case WATCH :
+				{
+					Watcher watcher(filename);
+					watcher.run();
+				}break;
 				case PARSE :
 				{
 					parser.parse();
+					if (isFlat(argv[1]))
+						parser.flatten();
 					parser.printTree();
 				}break;
-
 				default :
-				{
-					int i = strlen(filename);
-					outStream = filename;
-					while (i >= 0 && outStream[i--] != '.' && outStream[i] != '\\');
-	
-					CodeGen generator(parser, outStream = outStream.substr(0, (i == 0 ? strlen(filename) : i + 1)) + ".asm");
-					generator.generate();
-				}
+					break;
 			}
 			fclose(file);
 		}
@@ -1,17 +1,12 @@
 ﻿#include "node.h"
 #include "codeGen.h"
+#include <limits.h>
 
-#define DW(value) ("dword ptr " + value)
-#define QW(value) ("qword ptr " + value)
-#define OFFSET(value) ("offset " + value)
-#define ADR(value) ("[" + value + "]")
 #define EBP(value) (value + "[ebp]")
-#define RET(name) (name + "RetLabel")
 #define LEFT_CHILD(children) (children[0])
 #define RIGHT_CHILD(children) (children[1])
 #define ONLY_CHILD(children) (children[0])
 #define TERNARY_CHILD(children) (children[2])
-#define SHIFT(arr, shift) (arr.substr(0, arr.length() - 1) + " + " + shift + "]")
 
 
 static void SemException(int line, int col, const string& err)
@@ -51,7 +46,7 @@ static bool maybeCastWithPointer(SymType* p1, SymType* p2)
 
 static void throwAssignmentError(Token& op, string t1, string t2)
 {
-	SemException(op.line, op.col, "to use operator " + op.text + " for types : " + t1 + " and " + t2 + " is impossible");
+	SemException(op.getLine(), op.getCol(), "to use operator " + op.getText() + " for types : " + t1 + " and " + t2 + " is impossible");
 }
 
 ExprNode* tryCastInAssignment(SymType* t1, ExprNode* e, Token _token)
@@ -61,7 +56,7 @@ ExprNode* tryCastInAssignment(SymType* t1, ExprNode* e, Token _token)
 	return !t1->equal(e->getType()) ? new ExprCast(t1, e) : e;
 }
 
-static bool isLogic(Token& token)
+bool isLogic(const Token& token)
 {
 	return token == OP_AND || token == OP_OR || token == OP_EQUAL || token == OP_BOR || token == OP_GREATER ||
 		token == OP_GREATER_OR_EQUAL || token == OP_LESS ||  token == OP_LESS_OR_EQUAL || token == OP_XOR; 
@@ -136,17 +131,16 @@ void StmtNode::print(string str, bool isTail)
 InitList::InitList(Token _name, SymType* _type) : ExprNode(_name)
 {
 	if (*_type == FUNCTION || *_type == STRUCT)
-		SemException(token.line, token.col, "array cannot be init by this type");
+		SemException(token.getLine(), token.getCol(), "array cannot be init by this type");
 	type = _type;
 	length = 0;
-	shift = 0;
 };
 
 void InitList::add(ExprNode* arg)
 {
 	if (!static_cast<SymTypeArray*>(type)->dereference()->equal(arg->getType()))
 		if (!isArithmetic(static_cast<SymTypeArray*>(type)->dereference(), arg->getType()))
-			SemException(token.line, token.col, "different basic types");
+			SemException(token.getLine(), token.getCol(), "different basic types");
 		//else
 			//arg = //new ExprCast(static_cast<SymTypeArray*>(type)->dereference(), arg);
 	++length;
@@ -169,27 +163,27 @@ UnaryNode::UnaryNode(Token _token, ExprNode* _child) : ExprNode(_token)
 	case OP_AMP : case OP_DEC : case OP_INC :
 		{
 			if (!_child->lvalue())
-				SemException(_token.line, _token.col, "expression must be a modifiable lvalue");
+				SemException(_token.getLine(), _token.getCol(), "expression must be a modifiable lvalue");
 			if (_token == OP_AMP)
-				type = new SymTypePointer(type);
+				type = SymTypePointer::canonical(type);
 			else
 				if (!isIncrementOperand(_child))
-					SemException(_token.line, _token.col, "lvalue required as a increment operand");
+					SemException(_token.getLine(), _token.getCol(), "lvalue required as a increment operand");
 		}
 		break;
 
 	case OP_ASTERISK :
 		{
 			if (!type->isPointer())
-				SemException(_token.line, _token.col, "operand of '*' must be a pointer");
+				SemException(_token.getLine(), _token.getCol(), "operand of '*' must be a pointer");
 			if (*static_cast<SymTypePointer*>(type)->dereference() == VOID)
-				SemException(_token.line, _token.col, "expression must be a pointer to a complete object type");
+				SemException(_token.getLine(), _token.getCol(), "expression must be a pointer to a complete object type");
 			type = static_cast<SymTypePointer*>(type)->dereference();
 		}break;
 
 	case OP_ADD : case OP_SUB :
 		if (!isArithmetic(_child))
-			SemException(_token.line, _token.col, "operand of '+' must have float or int types");
+			SemException(_token.getLine(), _token.getCol(), "operand of '+' must have float or int types");
 	}
 	if (*type != FUNCTION)
 		isLvalue = true;
@@ -203,17 +197,17 @@ BinaryNode::BinaryNode(Token _token, ExprNode *_lChild, ExprNode *_rChild) : Exp
 	case OP_ASTERISK :
 	case OP_DIV :
 		if (!isArithmetic(_lChild) || !isArithmetic(_rChild))
-			SemException(_token.line, _token.col, "invalid operands for binary " + _token.text + "(" + _lChild->getName() + ", " + _rChild->getName() + ")");
+			SemException(_token.getLine(), _token.getCol(), "invalid operands for binary " + _token.getText() + "(" + _lChild->getName() + ", " + _rChild->getName() + ")");
 		break;
 
 	case OP_ADD :
 	case OP_SUB :
 		{
 			if (_lChild->isPointer() && _rChild->isPointer() && _token == OP_ADD)
-				SemException(_token.line, _token.col, "pointer + pointer is not allowed");
+				SemException(_token.getLine(), _token.getCol(), "pointer + pointer is not allowed");
 
 			if (!isIncrementOperand(_lChild) && !isIncrementOperand(_rChild))
-				SemException(_token.line, _token.col, "invalid operands for binary " + _token.text + "(" + _lChild->getName() + ", " + _rChild->getName() + ")");
+				SemException(_token.getLine(), _token.getCol(), "invalid operands for binary " + _token.getText() + "(" + _lChild->getName() + ", " + _rChild->getName() + ")");
 		}
 		break;
 
@@ -221,7 +215,7 @@ BinaryNode::BinaryNode(Token _token, ExprNode *_lChild, ExprNode *_rChild) : Exp
 	case OP_OR :
 		{
 			if (!isIncrementOperand(_lChild->getType()) ||  !isIncrementOperand(_rChild->getType()))
-				SemException(_token.line, _token.col, "requared scalar type for binary " + _token.text);
+				SemException(_token.getLine(), _token.getCol(), "requared scalar type for binary " + _token.getText());
 			if (*_lChild != INT)
 				_lChild = new ExprCast(_int, _lChild);
 			if (*_rChild != INT)
@@ -309,7 +303,7 @@ TernaryNode::TernaryNode(Token _token, ExprNode *_fChild, ExprNode *_sChild, Exp
 	type = _sChild->getType();
 }
 
-ExprFieldSelect::ExprFieldSelect(Token _token, ExprNode *_lChild, ExprNode *_rChild) : ExprNode(_token)
+ExprFieldSelect::ExprFieldSelect(Token _token, ExprNode *_lChild, ExprNode *_rChild, size_t _field) : ExprNode(_token), field(_field)
 {
 	type = _rChild->getType();
 	children.push_back(_lChild);
@@ -321,7 +315,7 @@ ExprFieldSelect::ExprFieldSelect(Token _token, ExprNode *_lChild, ExprNode *_rCh
 ExprIndexing::ExprIndexing(Token _token, ExprNode *_lChild, ExprNode *_rChild) : ExprNode(_token)
 {
 	if (!(_lChild->lvalue() && _lChild->isPointer()))
-		SemException(_token.line, _token.col, "expression must have pointer-to-object type");
+		SemException(_token.getLine(), _token.getCol(), "expression must have pointer-to-object type");
 	children.push_back(_lChild);
 	children.push_back(_rChild);
 	type = static_cast<SymTypePointer*>(_lChild->getType())->dereference();
@@ -332,7 +326,7 @@ ExprAssignment::ExprAssignment(Token _token, ExprNode *_lChild, ExprNode *_rChil
 {
 	type = _lChild->getType();
 	if (!_lChild->lvalue())
-		SemException(_token.line, _token.col, "expression must be a modifiable lvalue");
+		SemException(_token.getLine(), _token.getCol(), "expression must be a modifiable lvalue");
 	if (toCast)
 		_rChild = tryCastInAssignment(_lChild->getType(), _rChild, _token);
 	switch(_token)
@@ -351,7 +345,7 @@ ExprAssignment::ExprAssignment(Token _token, ExprNode *_lChild, ExprNode *_rChil
 PostfixUnaryNode::PostfixUnaryNode(Token _token, ExprNode* _child) : ExprNode(_token)
 {
 	if (!_child->lvalue() || !isIncrementOperand(_child))
-		SemException(_token.line, _token.col, "lvalue required as a increment operand");
+		SemException(_token.getLine(), _token.getCol(), "lvalue required as a increment operand");
 	type = _child->getType();
 	children.push_back(_child);
 }
@@ -366,7 +360,7 @@ StmtJump::StmtJump(Token _token, StmtNode* _stmt, SymType* retType) : StmtNode(_
 	if (token == KW_RETURN)
 	{
 		if (!_stmt->getType()->equal(retType) && !isArithmetic(_stmt->getType(), retType))
-			SemException(_token.line, _token.col, "return : cannot convert from \'float *\' to \'int *\'");
+			SemException(_token.getLine(), _token.getCol(), "return : cannot convert from \'float *\' to \'int *\'");
 		if (isArithmetic(_stmt->getType(), retType) && !_stmt->getType()->equal(retType))
 			_stmt->setExpr(new ExprCast(retType, _stmt->getExpr()));		
 	}
@@ -411,660 +405,301 @@ StmtLabeled::StmtLabeled(Token _token, StmtNode *_stmt, ExprNode* e) : StmtNode(
 	expr.push_back(e);
 }
 
-static void compareOpDoubleGen(CodeGen& gen, CommandT opType)
-{
-	gen.addCommand(ASM_XOR, getReg(REG_ECX), getReg(REG_ECX));
-	gen.addCommand(ASM_COMISD, getReg(REG_XMM0), getReg(REG_XMM1));
-	gen.addCommand(opType, getReg(REG_CL));
-	gen.addCommand(ASM_PUSH, getReg(REG_ECX));
-}
-
-static void pushDouble(CodeGen& gen, string name)
-{
-	gen.shiftStack(-8);
-	gen.addCommand(ASM_SUB, getReg(REG_ESP), to_string(8));
-	gen.addCommand(ASM_MOVSD, getReg(REG_XMM0), name);
-	gen.addCommand(ASM_MOVSD, QW(ADR(getReg(REG_ESP))), getReg(REG_XMM0)); 
-}
-
-static void popDouble(CodeGen& gen)
-{
-	gen.shiftStack(8);
-	gen.addCommand(ASM_MOVSD, getReg(REG_XMM0), QW(ADR(getReg(REG_ESP))));
-	gen.addCommand(ASM_ADD, getReg(REG_ESP), to_string(8));
-}
-static void simpleOpIntGen(CodeGen& gen, CommandT opType)
-{
-	gen.addCommand(opType, getReg(REG_EAX), getReg(REG_EBX));
-	gen.addCommand(ASM_PUSH, getReg(REG_EAX));
-}
-
-static void divisionOpIntGen(CodeGen& gen, bool isMod = false)
-{
-	gen.addCommand(ASM_CDQ);
-	gen.addCommand(ASM_IDIV, getReg(REG_EBX));
-	gen.addCommand(ASM_PUSH, getReg(isMod ? REG_EDX : REG_EAX));
-}
-
-static void compareOpIntGen(CodeGen& gen, CommandT opType)
-{
-	gen.addCommand(ASM_XOR, getReg(REG_ECX), getReg(REG_ECX));
-	gen.addCommand(ASM_CMP, getReg(REG_EAX), getReg(REG_EBX));
-	gen.addCommand(opType, getReg(REG_CL));
-	gen.addCommand(ASM_PUSH, getReg(REG_ECX));
-}
-
-static void logIntGen(CodeGen& gen, CommandT cond, string label, RegT r)
-{
-	gen.addCommand(ASM_TEST, getReg(r), getReg(r));
-	gen.addCommand(cond, label);
-}
-
-static void logAndOrIntGen(CodeGen& gen, bool isAnd = true)
-{
-	string finishL = gen.genLabel(), falseL = gen.genLabel();
-	logIntGen(gen, (isAnd ? ASM_JZ : ASM_JNZ), falseL, REG_EAX);
-	logIntGen(gen, (isAnd ? ASM_JZ : ASM_JNZ), falseL, REG_EBX);
-
-	gen.addCommand(ASM_PUSH, string(isAnd ? "1" : "0") );
-	gen.addCommand(ASM_JMP, string(finishL));
-	gen.addLabel(string(falseL));
-	gen.addCommand(ASM_PUSH, string(isAnd ? "0" : "1"));
-	gen.addLabel(string(finishL));
-}
-
-void static simpleAssignment(CodeGen& gen)
-{
-	gen.addCommand(ASM_POP, getReg(REG_EBX));
-	gen.addCommand(ASM_POP, getReg(REG_EAX));
-	gen.addCommand(ASM_MOV, DW(ADR(getReg(REG_EAX))), getReg(REG_EBX));
-	gen.addCommand(ASM_PUSH, DW(ADR(getReg(REG_EAX))));
-}
-
-static void simpleOpDoubleGen(CodeGen& gen, CommandT opType)
-{
-	gen.addCommand(opType, getReg(REG_XMM0), getReg(REG_XMM1));
-	pushDouble(gen, getReg(REG_XMM0));
-}
-
-void UnaryNode::gen(CodeGen& gen)
+size_t StmtCompound::genLocal(CodeGen& gen, int beforeSize, int& level, int& paramShift)
 {
-	switch(token)
+	size_t lShift = beforeSize;
+	bool isParamList = true;
+	int i = 0;
+	for (size_t j = 0; table != NULL && j < table->size(); j++)
 	{
-
-	case OP_ASTERISK :
-		{
-			ONLY_CHILD(children)->gen(gen);
-			gen.addCommand(ASM_POP, getReg(REG_EAX));
-
-			if (*type == DOUBLE || *type == FLOAT)
-				pushDouble(gen, QW(ADR(getReg(REG_EAX))));
-			else
-				gen.addCommand(ASM_PUSH, DW(ADR(getReg(REG_EAX))));
-		}break;
-	
-
-	case OP_AMP : ONLY_CHILD(children)->genLvalue(gen); break;
-
-	case OP_INC : case OP_DEC :
-		{
-			ONLY_CHILD(children)->genLvalue(gen);
-			gen.addCommand(ASM_POP, getReg(REG_EAX));
-			if (*type == INT)
-			{
-				gen.addCommand(token == OP_INC ? ASM_INC : ASM_DEC, DW(ADR(getReg(REG_EAX))));
-				gen.addCommand(ASM_PUSH, getReg(REG_EAX));
-			}
-			else
-			{
-				gen.addCommand(ASM_MOVSD,  getReg(REG_XMM0), QW(ADR(getReg(REG_EAX))));
-				gen.addCommand(token == OP_INC ? ASM_ADDSD : ASM_SUBSD, getReg(REG_XMM0), getPrefix(to_string(1), PREFIX_DOUBLE_CONST));
-				gen.addCommand(ASM_MOVSD,  QW(ADR(getReg(REG_EAX))), getReg(REG_XMM0));
-				pushDouble(gen, getReg(REG_XMM0));
-			}
-		}break;
-
-	case OP_NOT :
-		{
-			ONLY_CHILD(children)->gen(gen);
-			gen.addCommand(ASM_PUSH, to_string(0));
-			if (*ONLY_CHILD(children) == DOUBLE)
-			{
-				popDouble(gen);
-				compareOpDoubleGen(gen, ASM_SETE);
-			}
-			else	
-			{	
-				gen.addCommand(ASM_POP, getReg(REG_EAX));
-				compareOpIntGen(gen, ASM_SETE);
-			}
-		}break;
-	case OP_ADD : ONLY_CHILD(children)->gen(gen);break;
-	case OP_SUB : 
+		Symbol* var = table->at(j);
+		if (!var->isVar())
+			continue;
+		if (isParamList)
 		{
-			if (*ONLY_CHILD(children) == DOUBLE)
-			{
-				pushDouble(gen, getPrefix(to_string(2), PREFIX_DOUBLE_CONST));
-				ONLY_CHILD(children)->gen(gen);
-				popDouble(gen);
-				gen.addCommand(ASM_MOVSD, getReg(REG_XMM1), getReg(REG_XMM0));
-				popDouble(gen);
-				simpleOpDoubleGen(gen, ASM_SUBSD);
-			}
+			if (var->isLocal())
+				isParamList = false;
 			else
 			{
-				gen.addCommand(ASM_POP, getReg(REG_EAX));
-				gen.addCommand(ASM_NEG, getReg(REG_EAX));
-				gen.addCommand(ASM_PUSH, getReg(REG_EAX));
+				paramShift += var->getType()->getSize();
+				if (i++ == 0)
+					paramShift = 8;
 			}
 		}
+		if (!isParamList)
+			lShift += var->getType()->getSize();
+		var->gen(gen);
+		string asmName = var->getName();
+		if (var->isLocal() || var->isParam())
+			asmName = getPrefix(asmName, var->isLocal() ? PREFIX_LOCAL : PREFIX_PARAM);
+		gen.addLocalVars(asmName += to_string(level), to_string(var->isLocal() ? -((int)lShift) : (int)paramShift));
+		static_cast<SymVar*>(var)->setAsmName(EBP(asmName));
 	}
-}
-
-void binaryIntGen(CodeGen& gen, Token& op)
-{
-	gen.addCommand(ASM_POP, getReg(REG_EBX));
-	gen.addCommand(ASM_POP, getReg(REG_EAX));
 
-	switch(op)
-	{
-	case OP_ADD : simpleOpIntGen(gen, ASM_ADD) ;break;
-	case OP_SUB : simpleOpIntGen(gen, ASM_SUB); break;
-	case OP_ASTERISK : simpleOpIntGen(gen, ASM_IMUL); break;
-
-	case OP_AMP : simpleOpIntGen(gen, ASM_AND); break;
-	case OP_BOR : simpleOpIntGen(gen, ASM_OR); break;
-	case OP_XOR : simpleOpIntGen(gen, ASM_XOR); break;
-
-	case OP_EQUAL : compareOpIntGen(gen, ASM_SETE); break;
-	case OP_UNEQUAL : compareOpIntGen(gen, ASM_SETNE); break;
-	case OP_LESS_OR_EQUAL : compareOpIntGen(gen, ASM_SETLE); break;
-	case OP_GREATER_OR_EQUAL : compareOpIntGen(gen, ASM_SETGE); break;
-	case OP_LESS : compareOpIntGen(gen, ASM_SETL); break;
-	case OP_GREATER : compareOpIntGen(gen, ASM_SETG); break;
-
-	case OP_DIV : divisionOpIntGen(gen); break;
-	case OP_MOD : divisionOpIntGen(gen, true); break;
-
-	case OP_AND : logAndOrIntGen(gen); break;
-	case OP_OR : logAndOrIntGen(gen, false);break;
-	}
+	for (int i = 0; i < compounds.size(); i++)
+		lShift = static_cast<StmtCompound*>(compounds[i])->genLocal(gen, lShift, ++level, paramShift);
+	return lShift;
 }
 
-void binaryDoubleGen(CodeGen& gen, Token& op)
-{
-	popDouble(gen);
-	gen.addCommand(ASM_MOVSD, getReg(REG_XMM1), getReg(REG_XMM0));
-	popDouble(gen);
 
-	switch(op)
-	{
-	case OP_ADD : simpleOpDoubleGen(gen, ASM_ADDSD) ;break;
-	case OP_SUB : simpleOpDoubleGen(gen, ASM_SUBSD); break;
-	case OP_ASTERISK : simpleOpDoubleGen(gen, ASM_MULSD); break;
-	case OP_DIV : simpleOpDoubleGen(gen, ASM_DIVSD); break;
-
-	case OP_AMP : simpleOpDoubleGen(gen, ASM_AND); break;
-	case OP_BOR : simpleOpDoubleGen(gen, ASM_OR); break;
-	case OP_XOR : simpleOpDoubleGen(gen, ASM_XOR); break;
-
-	case OP_EQUAL : compareOpDoubleGen(gen, ASM_SETE); break;
-	case OP_UNEQUAL : compareOpDoubleGen(gen, ASM_SETNE); break;
-	case OP_LESS_OR_EQUAL : compareOpDoubleGen(gen, ASM_SETBE); break;
-	case OP_GREATER_OR_EQUAL : compareOpDoubleGen(gen, ASM_SETAE); break;
-	case OP_LESS : compareOpDoubleGen(gen, ASM_SETB); break;
-	case OP_GREATER : compareOpDoubleGen(gen, ASM_SETA); break;
-	}
-}
-
-void static binaryPointerGen(CodeGen& gen, Token op, vector<ExprNode*>& children, bool isPointerLeft)
+/*
+	constant folding runs over the finished trees before code generation:
+	every fold returns the node that takes this one's place, a constant of
+	the same type when the value is known at compile time and the node
+	itself otherwise. Values follow C on a 32 bit int: arithmetic wraps,
+	and a division by zero or a shift out of range is left to run time
+*/
+static bool isIntConst(ExprNode* node)
 {
-	if (op == OP_ADD)
-	{
-		ExprNode* pointer = isPointerLeft ? LEFT_CHILD(children) : RIGHT_CHILD(children);
-		SymType* pType = static_cast<SymTypePointer*>(pointer->getType())->dereference();
-		RegT left = isPointerLeft ? REG_EBX : REG_EAX, right = !isPointerLeft ? REG_EBX : REG_EAX;
-		gen.addCommand(ASM_POP, getReg(left));
-		gen.addCommand(ASM_POP, getReg(right));
-		gen.addCommand(ASM_IMUL, getReg(REG_EBX), to_string(pType->getSize()));
-		gen.addCommand(ASM_ADD, getReg(REG_EAX), getReg(REG_EBX));	
-	}
-	if (op == OP_SUB)
-	{
-		gen.addCommand(ASM_POP, getReg(REG_EBX));
-		gen.addCommand(ASM_POP, getReg(REG_EAX));
-		gen.addCommand(ASM_SUB, getReg(REG_EAX), getReg(REG_EBX));
-	}
-	gen.addCommand(ASM_PUSH, getReg(REG_EAX));
+	return node->isConst() && *node == INT;
 }
 
-void BinaryNode::gen(CodeGen& gen)
+static bool isDoubleConst(ExprNode* node)
 {
-
-	LEFT_CHILD(children)->gen(gen);
-	RIGHT_CHILD(children)->gen(gen);
-	
-#define isType(type) *LEFT_CHILD(children) == type || *RIGHT_CHILD(children) == type
-
-	if (isType(POINTER))
-	{
-		binaryPointerGen(gen, token, children, *LEFT_CHILD(children) == POINTER);
-		return;
-	}
-	if (isType(DOUBLE) && !isLogic(token))
-		binaryDoubleGen(gen, token);
-	if (isType(INT))
-		binaryIntGen(gen, token);
-	
-#undef isType
+	return node->isConst() && *node == DOUBLE;
 }
 
-void TernaryNode::gen(CodeGen& gen)
+static bool isIntConst(ExprNode* node, int value)
 {
-	string end = gen.genLabel(), rightCond = gen.genLabel();
-
-	LEFT_CHILD(children)->gen(gen);
-	gen.addCommand(ASM_POP, getReg(REG_ECX));
-	gen.addCommand(ASM_JZ, rightCond);
-	RIGHT_CHILD(children)->gen(gen);
-	gen.addCommand(ASM_JMP, end);
-	gen.addLabel(rightCond);
-	TERNARY_CHILD(children)->gen(gen);
-	gen.addLabel(end);
+	return isIntConst(node) && node->getToken().intValue() == value;
 }
 
-void PostfixUnaryNode::gen(CodeGen& gen)
+static ExprNode* intConst(Token token, int value)
 {
-	ONLY_CHILD(children)->genLvalue(gen);
-	gen.addCommand(ASM_POP, getReg(REG_EAX));
-	if (*type == INT)
-	{
-		gen.addCommand(ASM_MOV, getReg(REG_EBX), DW(ADR(getReg(REG_EAX)))); 
-		gen.addCommand(token == OP_INC ? ASM_INC : ASM_DEC, DW(ADR(getReg(REG_EAX))));
-		gen.addCommand(ASM_PUSH, getReg(REG_EBX));
-	}
-	else
-	{
-		gen.addCommand(ASM_MOVSD, getReg(REG_XMM1), QW(ADR(getReg(REG_EAX)))); 
-		gen.addCommand(ASM_MOVSD,  getReg(REG_XMM0), QW(ADR(getReg(REG_EAX))));
-		gen.addCommand(token == OP_INC ? ASM_ADDSD : ASM_SUBSD, getReg(REG_XMM0), getPrefix(to_string(1), PREFIX_DOUBLE_CONST));
-		gen.addCommand(ASM_MOVSD,  QW(ADR(getReg(REG_EAX))), getReg(REG_XMM0));
-		pushDouble(gen, getReg(REG_XMM1));
-	}
+	token.type = INT_CONST;
+	token.textId = INT_CONST;
+	token.val.iValue = value;
+	return new IntegerConst(token);
 }
 
-void ExprConst::gen(CodeGen& gen)
+static ExprNode* doubleConst(Token token, double value)
 {
-	gen.addCommand(ASM_PUSH, getValue(0));
+	token.type = DOUBLE_CONST;
+	token.textId = DOUBLE_CONST;
+	token.val.fValue = value;
+	return new DoubleConst(token);
 }
 
-void FloatConst::gen(CodeGen& gen)
+/* a comparison takes the type of its node, which is double for != of doubles */
+static ExprNode* typedConst(ExprNode* node, const Token& token, double value)
 {
-	//gen.addCommand(ASM_PUSH, getValue(0));
+	return *node == INT ? intConst(token, (int)value) : doubleConst(token, value);
 }
 
-void DoubleConst::gen(CodeGen& gen)
+static bool foldInt(const Token& op, int l, int r, int& value)
 {
-	string name;
-	if (!gen.hasConst(DOUBLE, getValue(2)))
+	unsigned int a = l, b = r;
+	switch(op)
 	{
-		gen.insertConst(DOUBLE, getValue(2));
-		name = getPrefix(to_string(gen.getConstCount(DOUBLE)), PREFIX_DOUBLE_CONST);
-		gen.addDQ(name, getValue(2), 8);
+	case OP_ADD : value = a + b; break;
+	case OP_SUB : value = a - b; break;
+	case OP_ASTERISK : value = a * b; break;
+	case OP_DIV : case OP_MOD :
+		if (r == 0 || (l == INT_MIN && r == -1))
+			return false;
+		value = op == OP_DIV ? l / r : l % r;
+		break;
+	case OP_AMP : value = l & r; break;
+	case OP_BOR : value = l | r; break;
+	case OP_XOR : value = l ^ r; break;
+	case OP_L_SHIFT : case OP_R_SHIFT :
+		if (r < 0 || r > 31)
+			return false;
+		value = op == OP_L_SHIFT ? (int)(a << r) : l >> r;
+		break;
+	case OP_EQUAL : value = l == r; break;
+	case OP_UNEQUAL : value = l != r; break;
+	case OP_LESS : value = l < r; break;
+	case OP_LESS_OR_EQUAL : value = l <= r; break;
+	case OP_GREATER : value = l > r; break;
+	case OP_GREATER_OR_EQUAL : value = l >= r; break;
+	case OP_AND : value = l && r; break;
+	case OP_OR : value = l || r; break;
+	default : return false;
 	}
-	else
-		name = gen.getConst(DOUBLE, getValue(2));
-	pushDouble(gen, QW(name));
+	return true;
 }
 
-void StringConst::gen(CodeGen& gen)
+static bool foldDouble(const Token& op, double l, double r, double& value)
 {
-	string name;
-	if (!gen.hasConst(STRING, token.val.strValue))
+	switch(op)
 	{
-		gen.insertConst(STRING, token.val.strValue);
-		name = getPrefix(to_string(gen.getConstCount(STRING)), PREFIX_STRING_CONST);
-		gen.addDB(name, token.val.strValue);
+	case OP_ADD : value = l + r; break;
+	case OP_SUB : value = l - r; break;
+	case OP_ASTERISK : value = l * r; break;
+	case OP_DIV :
+		if (r == 0)
+			return false;
+		value = l / r;
+		break;
+	case OP_EQUAL : value = l == r; break;
+	case OP_UNEQUAL : value = l != r; break;
+	case OP_LESS : value = l < r; break;
+	case OP_LESS_OR_EQUAL : value = l <= r; break;
+	case OP_GREATER : value = l > r; break;
+	case OP_GREATER_OR_EQUAL : value = l >= r; break;
+	default : return false;
 	}
-	else
-		name = gen.getConst(STRING, token.val.strValue);
-	gen.addCommand(ASM_PUSH, OFFSET(name));
+	return true;
 }
 
-void InitList::gen(CodeGen& gen)
+ExprNode* ExprNode::fold()
 {
-	int prev = 0;
-	vector<ExprNode*> v = getChildren();
-	for (size_t i = 0; i < v.size(); i++)
-	{
-		ExprNode* x = v[i];
-		if (prev != 0)
-			shift += prev;
-		prev = x->getType()->getSize();
-		if (*x == ARRAY)
-		{
-			static_cast<InitList*>(x)->initShift(shift);
-			x->gen(gen);
-		}
-		else
-		{
-			if(static_cast<SymTypeArray*>(getType())->isGlobal())
-			{
-				if (static_cast<SymTypeArray*>(getType())->dereference()->getSize() == 4)
-					gen.addDD(string(), x->getValue(0), 4);
-				else
-					gen.addDQ(string(), x->getValue(2), 8);
-			}
-			else
-			{
-				if (x->getType()->getSize() == 4)
-					gen.addCommand(ASM_MOV, DW(SHIFT(static_cast<SymTypeArray*>(getType())->getVarAsmName(), to_string(shift))), x->getValue(0));
-				else
-				{
-					gen.addCommand(ASM_MOVSD, getReg(REG_XMM0), QW(x->getValue(2)));
-					gen.addCommand(ASM_MOVSD, QW(SHIFT(static_cast<SymTypeArray*>(getType())->getVarAsmName(), to_string(shift))), getReg(REG_XMM0));
-				}
-
-			}
-		}
-	}
+	for (size_t i = 0; i < children.size(); i++)
+		if (children[i] != NULL)
+			children[i] = children[i]->fold();
+	return this;
 }
 
-void ExprFieldSelect::gen(CodeGen& gen)
+/* whether dropping the expression loses nothing but its value */
+bool ExprNode::isPure()
 {
+	for (size_t i = 0; i < children.size(); i++)
+		if (children[i] != NULL && !children[i]->isPure())
+			return false;
+	return true;
 }
 
-
-void static doubleAssignment(CodeGen& gen)
+ExprNode* ExprVar::fold()
 {
-	popDouble(gen);
-	gen.addCommand(ASM_POP, getReg(REG_EAX));
-	gen.addCommand(ASM_MOVSD, QW(ADR(getReg(REG_EAX))), getReg(REG_XMM0));
-	pushDouble(gen, getReg(REG_XMM0));
+	if (sym->isEnumConst())
+		return intConst(token, static_cast<SymTypeEnumConst*>(sym)->getIndex());
+	return this;
 }
 
-void ExprAssignment::gen(CodeGen& gen)
+bool UnaryNode::isPure()
 {
-	if (*LEFT_CHILD(children) != ARRAY)
-		LEFT_CHILD(children)->genLvalue(gen);
-	RIGHT_CHILD(children)->gen(gen);
-
-	if (*LEFT_CHILD(children) == STRUCT)
-	{
-		//lala topola
-	}
-			
-	if (*LEFT_CHILD(children) == DOUBLE)
-		doubleAssignment(gen);
-	if (*LEFT_CHILD(children) == INT || *LEFT_CHILD(children) == POINTER)
-		simpleAssignment(gen);
+	return token != OP_INC && token != OP_DEC && ExprNode::isPure();
 }
 
-void ExprCast::gen(CodeGen& gen)
+ExprNode* UnaryNode::fold()
 {
-	ONLY_CHILD(children)->gen(gen);
-	if (!toCast)
-		return;
-	if (*type == INT)
+	ExprNode::fold();
+	ExprNode* child = ONLY_CHILD(children);
+	bool isNegation = token == OP_SUB || token == OP_TILDA;
+	if (isNegation && child->getChildren().size() == 1 && child->getToken().type == token.type && !child->isCast())
+		return ONLY_CHILD(child->getChildren());
+	if (isIntConst(child))
 	{
-		popDouble(gen);
-		gen.addCommand(ASM_CVTTSD2SI, getReg(REG_EAX), getReg(REG_XMM0));
-		gen.addCommand(ASM_PUSH, getReg(REG_EAX));
+		unsigned int v = child->getToken().intValue();
+		switch(token)
+		{
+		case OP_ADD : return child;
+		case OP_SUB : return intConst(token, (int)(0u - v));
+		case OP_TILDA : return intConst(token, (int)~v);
+		case OP_NOT : return intConst(token, v == 0);
+		default : break;
+		}
 	}
-	if (*type == DOUBLE)
+	if (isDoubleConst(child))
 	{
-		if(*ONLY_CHILD(children) == INT)
+		double v = child->getToken().floatValue();
+		switch(token)
 		{
-			gen.addCommand(ASM_POP, getReg(REG_EAX));
-			gen.addCommand(ASM_CVTSI2SD, getReg(REG_XMM0), getReg(REG_EAX));
-			pushDouble(gen, getReg(REG_XMM0));
+		case OP_ADD : return child;
+		case OP_SUB : return doubleConst(token, -v);
+		case OP_NOT : return typedConst(this, token, v == 0);
+		default : break;
 		}
 	}
+	return this;
 }
 
-void ExprFuncCall::gen(CodeGen& gen)
+/* besides constants: x + 0, x - 0, x * 1, x / 1 and a pure x * 0 on ints, and the short circuits of && and || */
+ExprNode* BinaryNode::fold()
 {
-	SymTypeFunc* func = static_cast<SymTypeFunc*>(LEFT_CHILD(children)->getType());
-
-	size_t size = 0, rshift = func->dereference()->getSize();
-	gen.addCommand(ASM_SUB, getReg(REG_ESP), to_string(rshift));
-	gen.shiftStack(-rshift);
-
-	for (int i = children.size() - 1; i > 0; i--)
+	ExprNode::fold();
+	ExprNode *l = LEFT_CHILD(children), *r = RIGHT_CHILD(children);
+	if (isIntConst(l) && isIntConst(r))
 	{
-		children[i]->gen(gen);
-		size += children[i]->getType()->getSize();
+		int value;
+		if (*this == INT && foldInt(token, l->getToken().intValue(), r->getToken().intValue(), value))
+			return intConst(token, value);
+		return this;
 	}
-	
-	gen.addCommand(ASM_CALL, func->getVarAsmName());
-	gen.shiftStack(size);
-	gen.addCommand(ASM_ADD, getReg(REG_ESP), to_string(size));
-}
-
-void generateLvalue(CodeGen& gen, string name)
-{
-	gen.addCommand(ASM_LEA, getReg(REG_EAX), name);
-	gen.addCommand(ASM_PUSH, getReg(REG_EAX));
-}
-
-void ExprVar::gen(CodeGen& gen)
-{
-	if (*this == INT || *this == FLOAT)
-		gen.addCommand(ASM_PUSH, DW(static_cast<SymVar*>(sym)->getAsmName()));
-
-	else 
-		if (*this == DOUBLE)
-		pushDouble(gen, QW(static_cast<SymVar*>(sym)->getAsmName()));
-
-	else
-		if (*this == POINTER)
-		{
-			gen.addCommand(ASM_MOV, getReg(REG_EAX), DW(static_cast<SymVar*>(sym)->getAsmName()));//tmp for int
-			gen.addCommand(ASM_PUSH, getReg(REG_EAX));
-		}
-	else
-		genLvalue(gen);
-}
-
-void ExprVar::genLvalue(CodeGen& gen)
-{
-	if (sym->isGlobal())
-		gen.addCommand(ASM_PUSH, OFFSET(static_cast<SymVar*>(sym)->getAsmName()));
-	else
-		generateLvalue(gen, static_cast<SymVar*>(sym)->getAsmName());
-}
-
-void ExprIndexing::gen(CodeGen& gen)
-{
-	LEFT_CHILD(children)->gen(gen);
-	RIGHT_CHILD(children)->gen(gen);
-
-	binaryPointerGen(gen, Token(OP_ADD, "+", "+"), children, true);
-	gen.addCommand(ASM_POP, getReg(REG_EAX));
-
-	if (*type == DOUBLE || *type == FLOAT)
-		pushDouble(gen, QW(ADR(getReg(REG_EAX))));
-	else
-	if (*type == INT || *type == POINTER)
-		gen.addCommand(ASM_PUSH, DW(ADR(getReg(REG_EAX))));
-	else
-		gen.addCommand(ASM_PUSH, getReg(REG_EAX));
-}
-
-void StmtNode::gen(CodeGen& gen)
-{
-	gen.restoreStack();
-	gen.addEoln(1);
-}
-
-void StmtLabeled::gen(CodeGen& gen)
-{
-}
-
-void StmtSelection::gen(CodeGen& gen)
-{
-	string lElse = gen.genLabel() + "else", lEnd = gen.genLabel()  + "end";
-	LEFT_CHILD(expr)->gen(gen);
-	gen.addCommand(ASM_POP, getReg(REG_ECX));
-	gen.addCommand(ASM_CMP, getReg(REG_ECX), to_string(0));
-	gen.addCommand(ASM_JZ,  lElse);
-	LEFT_CHILD(stmt)->gen(gen);
-	gen.addCommand(ASM_JMP, lEnd);
-	gen.addLabel(lElse);
-	if (RIGHT_CHILD(stmt) != NULL)
-		RIGHT_CHILD(stmt)->gen(gen);
-	gen.addLabel(lEnd);
-}
-
-void StmtWhile::gen(CodeGen& gen)
-{
-	string lWhile = gen.genLabel() + "while", lendWhile = gen.genLabel()  + "endWhile";
-	gen.pushJumps(lWhile, lendWhile);
-	gen.addLabel(lWhile);
-	LEFT_CHILD(expr)->gen(gen);
-	gen.addCommand(ASM_POP, getReg(REG_ECX));
-	gen.addCommand(ASM_CMP, getReg(REG_ECX), to_string(0));
-	gen.addCommand(ASM_JZ,  lendWhile);
-	LEFT_CHILD(stmt)->gen(gen);
-	gen.addCommand(ASM_JMP, lWhile);
-	gen.addLabel(lendWhile);
-	gen.popJumps();
-}
-
-void StmtDo::gen(CodeGen& gen)
-{
-	string lDo = gen.genLabel() + "do", lEnd = gen.genLabel() + "endDo";
-	gen.pushJumps(lDo, lEnd);
-	gen.addLabel(lDo);
-	LEFT_CHILD(stmt)->gen(gen);
-	RIGHT_CHILD(stmt)->getExpr()->gen(gen);
-	gen.addCommand(ASM_POP, getReg(REG_ECX));
-	gen.addCommand(ASM_CMP, getReg(REG_ECX), to_string(0));
-	gen.addCommand(ASM_JNZ,  lDo);
-	gen.addLabel(lEnd);
-	gen.popJumps();
-}
-
-void StmtExpr::gen(CodeGen& gen)
-{
-	for (int i = 0; i < expr.size() && expr[i] != NULL; i++)
-		expr[i]->gen(gen);
-	StmtNode::gen(gen);
-}
-
-void StmtFor::gen(CodeGen& gen)
-{
-	string cond = gen.genLabel() + "cond", end = gen.genLabel() + "end", start = gen.genLabel() + "start";
-	gen.pushJumps(start, end);
-	LEFT_CHILD(stmt)->gen(gen);
-	gen.addCommand(ASM_JMP, cond);
-	gen.addLabel(start);
-	LEFT_CHILD(expr)->gen(gen);
-	gen.restoreStack();
-
-	gen.addLabel(cond);
-	RIGHT_CHILD(stmt)->getExpr()->gen(gen);
-	gen.addCommand(ASM_POP, getReg(REG_ECX));
-	gen.addCommand(ASM_CMP, getReg(REG_ECX), to_string(0));
-	gen.addCommand(ASM_JZ, end);
-
-	TERNARY_CHILD(stmt)->gen(gen);
-	gen.addCommand(ASM_JMP, start);
-	gen.addLabel(end);
-	gen.popJumps();
-}
-
-void StmtJump::gen(CodeGen& gen)
-{
+	if (isDoubleConst(l) && isDoubleConst(r))
+	{
+		double value;
+		if (foldDouble(token, l->getToken().floatValue(), r->getToken().floatValue(), value))
+			return typedConst(this, token, value);
+		return this;
+	}
+	if (*this != INT || *l != INT || *r != INT)
+		return this;
+	if ((token == OP_AND && isIntConst(l, 0)) || (token == OP_OR && isIntConst(l) && !isIntConst(l, 0)))
+		return intConst(token, token == OP_OR);
 	switch(token)
 	{
-	case KW_RETURN :
-		{
-			if (*this->getType() != VOID)
-			{
-				gen.addCommand(ASM_LEA, getReg(REG_EAX), string("func_ret[ebp]"));
-				gen.addCommand(ASM_PUSH, getReg(REG_EAX));
-				getExpr(0, 0)->gen(gen);
-				if (*this->getType() == INT)
-					simpleAssignment(gen);
-
-				if (*this->getType() == DOUBLE)
-					doubleAssignment(gen);
-			}			
-			StmtNode::gen(gen);
-			gen.addCommand(ASM_JMP, RET(gen.getLastFunction()));
-		}break;
-
-	case KW_BREAK : gen.addCommand(ASM_JMP, gen.getJumpBreak()); break;
-
-	default : gen.addCommand(ASM_JMP, gen.getJumpContinue()); break;
-
+	case OP_ADD :
+		if (isIntConst(l, 0))
+			return r;
+		if (isIntConst(r, 0))
+			return l;
+		break;
+	case OP_SUB :
+		if (isIntConst(r, 0))
+			return l;
+		break;
+	case OP_ASTERISK :
+		if (isIntConst(l, 1))
+			return r;
+		if (isIntConst(r, 1))
+			return l;
+		if ((isIntConst(l, 0) && r->isPure()) || (isIntConst(r, 0) && l->isPure()))
+			return intConst(token, 0);
+		break;
+	case OP_DIV :
+		if (isIntConst(r, 1))
+			return l;
+		break;
+	default : break;
 	}
-	StmtNode::gen(gen);
+	return this;
 }
 
-void StmtCompound::gen(CodeGen& gen)
+ExprNode* TernaryNode::fold()
 {
-	for (int i = 0; i < stmt.size(); i++)
-		stmt[i]->gen(gen);
+	ExprNode::fold();
+	ExprNode* condition = LEFT_CHILD(children);
+	if (isIntConst(condition))
+		return condition->getToken().intValue() != 0 ? RIGHT_CHILD(children) : TERNARY_CHILD(children);
+	if (isDoubleConst(condition))
+		return condition->getToken().floatValue() != 0 ? RIGHT_CHILD(children) : TERNARY_CHILD(children);
+	return this;
 }
 
-size_t StmtCompound::genLocal(CodeGen& gen, int beforeSize, int& level, int& paramShift)
+/* a conversion truncates like cvttsd2si, so a double out of the int range is left to run time */
+ExprNode* ExprCast::fold()
 {
-	Symbol* var = NULL;
-	size_t lShift = beforeSize;
-	bool isParamList = true;
-	int i = 0;
-	while ((var = table->next() )!= NULL)
+	ExprNode::fold();
+	ExprNode* child = ONLY_CHILD(children);
+	if (!toCast)
+		return child->isConst() && child->getType() == type && (*this == INT || *this == DOUBLE) ? child : this;
+	if (*this == DOUBLE && isIntConst(child))
+		return doubleConst(child->getToken(), child->getToken().intValue());
+	if (*this == INT && isDoubleConst(child))
 	{
-		if (!var->isVar())
-			continue;
-		if (isParamList)
-		{
-			if (var->isLocal())
-				isParamList = false;
-			else
-			{
-				paramShift += var->getType()->getSize();
-				if (i++ == 0)
-					paramShift = 8;
-			}
-		}
-		if (!isParamList)
-			lShift += var->getType()->getSize();
-		var->gen(gen);
-		string& asmName = static_cast<SymVar*>(var)->getAsmName();
-		gen.addLocalVars(asmName += to_string(level), to_string(var->isLocal() ? -((int)lShift) : (int)paramShift));
-		asmName = EBP(asmName);
+		double v = child->getToken().floatValue();
+		if (v > INT_MIN - 1.0 && v < INT_MAX + 1.0)
+			return intConst(child->getToken(), (int)v);
 	}
-
-	for (int i = 0; i < compounds.size(); i++)
-		lShift = static_cast<StmtCompound*>(compounds[i])->genLocal(gen, lShift, ++level, paramShift);
-	return lShift;
-}
-
-void PostfixUnaryNode::genLvalue(CodeGen& gen)
-{
-	//ONLY_CHILD(children)->gen(gen);
+	return this;
 }
 
-void UnaryNode::genLvalue(CodeGen& gen)
+StmtNode* StmtNode::fold()
 {
-	ONLY_CHILD(children)->gen(gen);	
+	for (size_t i = 0; i < expr.size(); i++)
+		if (expr[i] != NULL)
+			expr[i] = expr[i]->fold();
+	for (size_t i = 0; i < stmt.size(); i++)
+		if (stmt[i] != NULL)
+			stmt[i]->fold();
+	return this;
 }
 
-void ExprIndexing::genLvalue(CodeGen& gen)
+StmtNode* StmtCompound::fold()
 {
-	LEFT_CHILD(children)->gen(gen);
-	RIGHT_CHILD(children)->gen(gen);
-	binaryPointerGen(gen, Token(OP_ADD, "+", "+"), children, true);
+	for (size_t i = 0; table != NULL && i < table->size(); i++)
+		table->at(i)->fold();
+	return StmtNode::fold();
 }
-
-void ExprFieldSelect::genLvalue(CodeGen& gen)
-{
-
-}
-
-void ExprAssignment::genLvalue(CodeGen& gen){}
-
-void BinaryNode::genLvalue(CodeGen& gen){}
\ No newline at end of file
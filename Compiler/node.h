@@ -11,9 +11,42 @@ class CodeGen;
 class ExprNode;
 
 extern ExprNode* tryCastInAssignment(SymType* t1, ExprNode* e, Token _token);
+extern bool isLogic(const Token& token);
+
+/* the class of a node, which is all the flattened tree keeps of it; expressions come first */
+typedef enum
+{
+	NODE_EXPR,
+	NODE_VAR,
+	NODE_CONST,
+	NODE_FLOAT_CONST,
+	NODE_DOUBLE_CONST,
+	NODE_STRING_CONST,
+	NODE_UNARY,
+	NODE_POSTFIX,
+	NODE_CAST,
+	NODE_IMPLICIT_CAST,
+	NODE_BINARY,
+	NODE_TERNARY,
+	NODE_FUNC_CALL,
+	NODE_ASSIGNMENT,
+	NODE_INDEXING,
+	NODE_FIELD_SELECT,
+	NODE_INIT_LIST,
+	NODE_STMT,
+	NODE_JUMP,
+	NODE_COMPOUND,
+	NODE_EXPR_STMT,
+	NODE_SELECTION,
+	NODE_FOR,
+	NODE_WHILE,
+	NODE_DO,
+	NODE_LABELED,
+}NodeKindT;
 
 class ExprNode : public SyntaxNode
 {
+	friend class FlatTree;
 protected:
 
 	vector<ExprNode*> children;
@@ -34,22 +67,24 @@ public:
 	bool isPointer(){return type->isPointer();}
 	SymbolTable* getTable(){return type->getTable();}
 	virtual bool isConst(){return false;}
-	virtual void gen(CodeGen&){};
-	virtual void genLvalue(CodeGen&){};
-	vector<ExprNode*> getChildren() {return children;}
+	virtual bool isCast(){return false;}
+	virtual NodeKindT getKind(){return NODE_EXPR;}
+	virtual ExprNode* fold();
+	virtual bool isPure();
+	const vector<ExprNode*>& getChildren() {return children;}
 };
 
 class ExprVar : public ExprNode
 {
-
+	friend class FlatTree;
 protected:
 
 	Symbol* sym;
 public:
 
 	ExprVar(Token _token, Symbol* s);
-	void gen(CodeGen&);
-	void genLvalue(CodeGen&);
+	NodeKindT getKind(){return NODE_VAR;}
+	ExprNode* fold();
 };
 
 class ExprConst : public ExprNode
@@ -58,7 +93,7 @@ public:
 
 	ExprConst(Token _token) : ExprNode(_token){}
 	virtual bool isConst(){return true;}
-	virtual void gen(CodeGen&);
+	virtual NodeKindT getKind(){return NODE_CONST;}
 };
 
 class IntegerConst : public ExprConst
@@ -73,7 +108,7 @@ class FloatConst : public ExprConst
 public:
 
 	FloatConst(Token _token) : ExprConst(_token){type = _float;}
-	void gen(CodeGen&);
+	NodeKindT getKind(){return NODE_FLOAT_CONST;}
 };
 
 class DoubleConst : public ExprConst
@@ -81,16 +116,16 @@ class DoubleConst : public ExprConst
 public:
 
 	DoubleConst(Token _token) : ExprConst(_token){type = _double;}
-	void gen(CodeGen&);
+	NodeKindT getKind(){return NODE_DOUBLE_CONST;}
 };
 
 class StringConst : public ExprConst
 {
 public:
 
-	StringConst(Token _token) : ExprConst(_token) {type = new SymTypePointer(_int);};
+	StringConst(Token _token) : ExprConst(_token) {type = SymTypePointer::canonical(_int);};
 	bool isStringConst(){return true;}
-	void gen(CodeGen&);
+	NodeKindT getKind(){return NODE_STRING_CONST;}
 };
 
 class UnaryNode : public ExprNode
@@ -98,8 +133,9 @@ class UnaryNode : public ExprNode
 public:
 	
 	UnaryNode(Token _token, ExprNode* _child);
-	void gen(CodeGen&);
-	void genLvalue(CodeGen&);
+	NodeKindT getKind(){return NODE_UNARY;}
+	ExprNode* fold();
+	bool isPure();
 };
 
 class PostfixUnaryNode : public ExprNode
@@ -107,8 +143,8 @@ class PostfixUnaryNode : public ExprNode
 public:
 
 	PostfixUnaryNode(Token _token, ExprNode* _child);
-	void gen(CodeGen&);
-	void genLvalue(CodeGen&);
+	NodeKindT getKind(){return NODE_POSTFIX;}
+	bool isPure(){return false;}
 };
 
 class ExprCast : public ExprNode
@@ -120,8 +156,10 @@ public:
 
 	ExprCast(SymType* t, ExprNode* _child);
 	ExprCast(SymType* t, ExprNode* _child, bool _toCast);
-	void gen(CodeGen&);
+	bool isCast(){return true;}
+	NodeKindT getKind(){return toCast ? NODE_CAST : NODE_IMPLICIT_CAST;}
 	void print(string str, bool isTail);
+	ExprNode* fold();
 };
 
 class BinaryNode : public ExprNode
@@ -129,8 +167,8 @@ class BinaryNode : public ExprNode
 public:
 
 	BinaryNode(Token _token, ExprNode *_lChild, ExprNode *_rChild);
-	void gen(CodeGen&);
-	void genLvalue(CodeGen&);
+	NodeKindT getKind(){return NODE_BINARY;}
+	ExprNode* fold();
 };
 
 class TernaryNode : public ExprNode
@@ -138,7 +176,8 @@ class TernaryNode : public ExprNode
 public:
 
 	TernaryNode (Token _token, ExprNode *_fChild, ExprNode *_sChild, ExprNode *_tChild);
-	void gen(CodeGen&);
+	NodeKindT getKind(){return NODE_TERNARY;}
+	ExprNode* fold();
 };
 
 class ExprFuncCall : public ExprNode
@@ -146,7 +185,8 @@ class ExprFuncCall : public ExprNode
 public:
 
 	ExprFuncCall(Token _token, vector<ExprNode*> arg, SymTypeFunc* _type);
-	void gen(CodeGen&);
+	NodeKindT getKind(){return NODE_FUNC_CALL;}
+	bool isPure(){return false;}
 };
 
 class ExprAssignment : public ExprNode
@@ -154,8 +194,8 @@ class ExprAssignment : public ExprNode
 public:
 
 	ExprAssignment(Token _token, ExprNode *_lChild, ExprNode *_rChild, bool toCast = true);
-	void gen(CodeGen&);
-	void genLvalue(CodeGen&);
+	NodeKindT getKind(){return NODE_ASSIGNMENT;}
+	bool isPure(){return false;}
 };
 
 class ExprIndexing : public ExprNode
@@ -163,35 +203,37 @@ class ExprIndexing : public ExprNode
 public:
 
 	ExprIndexing(Token _token, ExprNode *_lChild, ExprNode *_rChild);
-	void gen(CodeGen&);
-	void genLvalue(CodeGen&);
+	NodeKindT getKind(){return NODE_INDEXING;}
 };
 
 class ExprFieldSelect : public ExprNode
 {
+	friend class FlatTree;
+private:
+
+	size_t field;
 public:
 
-	ExprFieldSelect(Token _token, ExprNode *_lChild, ExprNode *_rChild);
-	void gen(CodeGen&);
-	void genLvalue(CodeGen&);
+	ExprFieldSelect(Token _token, ExprNode *_lChild, ExprNode *_rChild, size_t _field);
+	NodeKindT getKind(){return NODE_FIELD_SELECT;}
 };
 
 class InitList : public ExprNode
 {
 private:
 
-	int length, shift;
+	int length;
 public:
 
 	InitList(Token _name, SymType* _type);
 	void add(ExprNode* arg);
-	void gen(CodeGen&);
+	NodeKindT getKind(){return NODE_INIT_LIST;}
 	int getLength() {return length;}
-	void initShift(int s){shift = s;}
 };
 
 class StmtNode : public SyntaxNode
 {
+	friend class FlatTree;
 protected:
 
 	vector<ExprNode*> expr;
@@ -204,7 +246,8 @@ public:
 	virtual void tablePrint(string out){};
 	virtual SymType* getType(){return NULL;}
 	virtual void setType(SymType* t){};
-	virtual void gen(CodeGen&);
+	virtual NodeKindT getKind(){return NODE_STMT;}
+	virtual StmtNode* fold();
 	ExprNode* getExpr(int i, int j) {return stmt[i]->expr[j];}
 	ExprNode* getExpr() {return *expr.rbegin();}
 	void setExpr(ExprNode* _expr){if (expr.size() > 0) expr[0] = _expr;}
@@ -218,7 +261,7 @@ public:
 	StmtJump(Token _token) : StmtNode(_token){};
 	SymType* getType(){return stmt[0]->getType() != NULL ? stmt[0]->getType() : _void;}
 	void setType(SymType* t) {stmt[0]->setType(t);}
-	void gen(CodeGen&);
+	NodeKindT getKind(){return NODE_JUMP;}
 };
 
 class StmtCompound : public StmtNode
@@ -231,10 +274,12 @@ public:
 
 	virtual bool isCompound(){return true;}
 	StmtCompound(Token _token, SymbolTable* _table, SymType* returnType);
-	virtual void tablePrint(string out){table->print(out, true);};
+	virtual void tablePrint(string out){if (table != NULL) table->print(out, true);};
 	SymbolTable* getTable(){return table;}
+	void setTable(SymbolTable* _table){table = _table;}
 	size_t genLocal(CodeGen&, int, int&, int&);
-	void gen(CodeGen&);
+	NodeKindT getKind(){return NODE_COMPOUND;}
+	StmtNode* fold();
 	void addCompound(StmtCompound* com) {compounds.push_back(com);}
 	void addStmt(StmtNode* _stmt){stmt.push_back(_stmt);}
 };
@@ -246,7 +291,7 @@ public:
 	StmtExpr(Token _token, ExprNode* _expr);
 	SymType* getType(){return expr[0] != NULL ? expr[0]->getType() : NULL;}
 	void setType(SymType* t){ if (expr[0] != NULL) expr[0]->setType(t);}
-	void gen(CodeGen&);
+	NodeKindT getKind(){return NODE_EXPR_STMT;}
 };
 
 class StmtSelection : public StmtNode
@@ -254,7 +299,7 @@ class StmtSelection : public StmtNode
 public:
 
 	StmtSelection(Token _token, ExprNode* _expr, StmtNode *ifBody, StmtNode* elseBody);
-	void gen(CodeGen&);
+	NodeKindT getKind(){return NODE_SELECTION;}
 };
 
 class StmtFor : public StmtNode
@@ -262,7 +307,7 @@ class StmtFor : public StmtNode
 public:
 
 	StmtFor(Token _token,  StmtNode *e1, StmtNode *e2, ExprNode* e, StmtNode* _stmt);
-	void gen(CodeGen&);
+	NodeKindT getKind(){return NODE_FOR;}
 };
 
 class StmtWhile : public StmtNode
@@ -270,7 +315,7 @@ class StmtWhile : public StmtNode
 public:
 
 	StmtWhile(Token _token, ExprNode *e, StmtNode* _stmt);
-	void gen(CodeGen&);
+	NodeKindT getKind(){return NODE_WHILE;}
 };
 
 class StmtDo : public StmtNode
@@ -278,7 +323,7 @@ class StmtDo : public StmtNode
 public:
 
 	StmtDo(Token _token, StmtNode *stmt1, StmtNode *stmt2);
-	void gen(CodeGen&);
+	NodeKindT getKind(){return NODE_DO;}
 };
 
 class StmtLabeled : public StmtNode
@@ -286,7 +331,7 @@ class StmtLabeled : public StmtNode
 public:
 
 	StmtLabeled(Token _token, StmtNode *_stmt, ExprNode* e);
-	void gen(CodeGen&);
+	NodeKindT getKind(){return NODE_LABELED;}
 };
 
 
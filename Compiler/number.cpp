@@ -0,0 +1,231 @@
+#include "number.h"
+#include <string.h>
+#include <math.h>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+#define SMALLEST_POWER -342
+#define LARGEST_POWER 308
+#define POWERS (LARGEST_POWER - SMALLEST_POWER + 1)
+#define EXPONENT_BIAS 1023
+#define MANTISSA_BITS 52
+
+static const double exactPowers[] =
+{
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/* 128-bit approximations of 5^q, high word first */
+static unsigned long long powersOfFive[2 * POWERS];
+static once_flag powersFlag;
+
+#ifdef __GNUC__
+static __inline int leadingZeros(unsigned long long x)
+{
+	return __builtin_clzll(x);
+}
+#else
+static __inline int leadingZeros(unsigned long long x)
+{
+	int n = 0;
+	for (; (x >> 63) == 0; x <<= 1)
+		n++;
+	return n;
+}
+#endif
+
+#ifdef __SIZEOF_INT128__
+static __inline void multiply(unsigned long long a, unsigned long long b, unsigned long long& high, unsigned long long& low)
+{
+	unsigned __int128 p = (unsigned __int128)a * b;
+	high = (unsigned long long)(p >> 64);
+	low = (unsigned long long)p;
+}
+#else
+static __inline void multiply(unsigned long long a, unsigned long long b, unsigned long long& high, unsigned long long& low)
+{
+	unsigned long long aLow = a & 0xFFFFFFFF, aHigh = a >> 32, bLow = b & 0xFFFFFFFF, bHigh = b >> 32;
+	unsigned long long ll = aLow * bLow, lh = aLow * bHigh, hl = aHigh * bLow, hh = aHigh * bHigh;
+	unsigned long long mid = (ll >> 32) + (lh & 0xFFFFFFFF) + (hl & 0xFFFFFFFF);
+	low = (mid << 32) | (ll & 0xFFFFFFFF);
+	high = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+}
+#endif
+
+/* little-endian 32-bit limbs, only used to build the table */
+typedef vector<unsigned int> BigT;
+
+static int bitLength(const BigT& n)
+{
+	int i = n.size() - 1;
+	while (i >= 0 && n[i] == 0)
+		i--;
+	if (i < 0)
+		return 0;
+	int bits = 32 * i;
+	for (unsigned int top = n[i]; top != 0; top >>= 1)
+		bits++;
+	return bits;
+}
+
+static unsigned long long bitsAt(const BigT& n, int from)
+{
+	unsigned long long r = 0;
+	for (int i = 63; i >= 0; i--)
+	{
+		int bit = from + i;
+		r <<= 1;
+		if (bit >= 0 && bit / 32 < (int)n.size())
+			r |= (n[bit / 32] >> (bit % 32)) & 1;
+	}
+	return r;
+}
+
+static void multiplySmall(BigT& n, unsigned int m)
+{
+	unsigned long long carry = 0;
+	for (size_t i = 0; i < n.size(); i++)
+	{
+		carry += (unsigned long long)n[i] * m;
+		n[i] = (unsigned int)carry;
+		carry >>= 32;
+	}
+	if (carry != 0)
+		n.push_back((unsigned int)carry);
+}
+
+static void divideSmall(BigT& n, unsigned int d)
+{
+	unsigned long long rest = 0;
+	for (int i = n.size() - 1; i >= 0; i--)
+	{
+		rest = (rest << 32) | n[i];
+		n[i] = (unsigned int)(rest / d);
+		rest %= d;
+	}
+}
+
+static void addOne(BigT& n)
+{
+	size_t i = 0;
+	for (; i < n.size() && ++n[i] == 0; i++);
+	if (i == n.size())
+		n.push_back(1);
+}
+
+static void storeTop(int q, const BigT& n)
+{
+	int bits = bitLength(n);
+	powersOfFive[2 * (q - SMALLEST_POWER)] = bitsAt(n, bits - 64);
+	powersOfFive[2 * (q - SMALLEST_POWER) + 1] = bitsAt(n, bits - 128);
+}
+
+/*
+	5^q for q >= 0 is truncated to its top 128 bits; for q < 0 the table
+	holds floor(2^b / 5^-q) + 1 truncated the same way, with b chosen so
+	that the quotient keeps at least 128 bits
+*/
+static void buildPowers()
+{
+	BigT power(1, 1);
+	vector<int> lengths(-SMALLEST_POWER + 1);
+	for (int q = 0; q <= -SMALLEST_POWER; q++)
+	{
+		if (q <= LARGEST_POWER)
+			storeTop(q, power);
+		lengths[q] = bitLength(power);
+		multiplySmall(power, 5);
+	}
+	for (int q = -1; q >= SMALLEST_POWER; q--)
+	{
+		int k = -q, b = q >= -27 ? lengths[k] + 127 : 2 * lengths[k] + 128;
+		BigT n(b / 32 + 1, 0);
+		n[b / 32] = 1u << (b % 32);
+		for (; k >= 13; k -= 13)
+			divideSmall(n, 1220703125);
+		for (; k > 0; k--)
+			divideSmall(n, 5);
+		addOne(n);
+		storeTop(q, n);
+	}
+}
+
+static __inline double fromBits(unsigned long long mantissa, int power2)
+{
+	unsigned long long bits = mantissa | (unsigned long long)power2 << MANTISSA_BITS;
+	double value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+bool decimalToDouble(const DecimalT& d, double& value)
+{
+	unsigned long long w = d.mantissa;
+	int q = d.exponent;
+	if (d.isTruncated)
+		return false;
+	if (w == 0 || q < SMALLEST_POWER)
+	{
+		value = 0;
+		return true;
+	}
+	if (q > LARGEST_POWER)
+	{
+		value = HUGE_VAL;
+		return true;
+	}
+	if (w <= (1ULL << 53) && q >= -22 && q <= 22)
+	{
+		value = q < 0 ? (double)w / exactPowers[-q] : (double)w * exactPowers[q];
+		return true;
+	}
+
+	call_once(powersFlag, buildPowers);
+	int lz = leadingZeros(w);
+	w <<= lz;
+	int index = 2 * (q - SMALLEST_POWER);
+	unsigned long long high, low, secondHigh, secondLow;
+	multiply(w, powersOfFive[index], high, low);
+	if ((high & 0x1FF) == 0x1FF)
+	{
+		multiply(w, powersOfFive[index + 1], secondHigh, secondLow);
+		low += secondHigh;
+		if (secondHigh > low)
+			high++;
+	}
+	if (low == 0xFFFFFFFFFFFFFFFFULL && (q < -27 || q > 55))
+		return false;
+
+	int upperBit = (int)(high >> 63), shift = upperBit + 64 - MANTISSA_BITS - 3;
+	unsigned long long mantissa = high >> shift;
+	int power2 = (((152170 + 65536) * q) >> 16) + 63 + upperBit - lz + EXPONENT_BIAS;
+	if (power2 <= 0)
+	{
+		if (-power2 + 1 >= 64)
+		{
+			value = 0;
+			return true;
+		}
+		mantissa >>= -power2 + 1;
+		mantissa += mantissa & 1;
+		mantissa >>= 1;
+		value = fromBits(mantissa, mantissa < (1ULL << MANTISSA_BITS) ? 0 : 1);
+		return true;
+	}
+	/* exactly halfway: the dropped bits were all zero, round to even */
+	if (low <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 && (mantissa << shift) == high)
+		mantissa &= ~1ULL;
+	mantissa += mantissa & 1;
+	mantissa >>= 1;
+	if (mantissa >= (2ULL << MANTISSA_BITS))
+	{
+		mantissa = 1ULL << MANTISSA_BITS;
+		power2++;
+	}
+	mantissa &= ~(1ULL << MANTISSA_BITS);
+	value = power2 >= 0x7FF ? HUGE_VAL : fromBits(mantissa, power2);
+	return true;
+}
@@ -0,0 +1,38 @@
+#ifndef NUMBER_H
+#define NUMBER_H
+
+/*
+	decimal literal as mantissa * 10^exponent; only the first 19 significant
+	digits fit the mantissa, the rest move the exponent and mark it truncated
+*/
+typedef struct
+{
+	unsigned long long mantissa;
+	int digits, exponent;
+	bool isTruncated;
+}DecimalT;
+
+static __inline void pushDecimalDigit(DecimalT& d, int digit, bool isFraction)
+{
+	if (d.digits < 19)
+	{
+		d.mantissa = d.mantissa * 10 + digit;
+		if (d.mantissa != 0)
+			d.digits++;
+		if (isFraction)
+			d.exponent--;
+		return;
+	}
+	if (!isFraction)
+		d.exponent++;
+	if (digit != 0)
+		d.isTruncated = true;
+}
+
+/*
+	correctly rounded conversion (Clinger's fast path, then Eisel-Lemire);
+	returns false for the rare inputs it cannot decide, strtod settles those
+*/
+extern bool decimalToDouble(const DecimalT& d, double& value);
+
+#endif
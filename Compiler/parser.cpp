@@ -1,30 +1,44 @@
 ﻿#include "parser.h" 
+#include <string.h>
+#include <set>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
-stack<StmtCompound*> compound;
-
-void static pushCompound(StmtCompound* com)
+void Parser::pushCompound(StmtCompound* com)
 {
 	compound.push(com);
 }
 
-void static popCompound()
+void Parser::popCompound()
 {
 	compound.pop();
 }
 
-StmtCompound* first()
+StmtCompound* Parser::topCompound()
 {
 	return compound.size() == 0 ? NULL : compound.top();
 }
 
-void static addCompound(StmtCompound* com)
+void Parser::clearCompounds()
+{
+	while (compound.size() != 0)
+		compound.pop();
+}
+
+size_t Parser::compoundDepth()
+{
+	return compound.size();
+}
+
+void Parser::addCompound(StmtCompound* com)
 {
 	if (compound.size() != 0)
-		first()->addCompound(com);
+		topCompound()->addCompound(com);
 	pushCompound(com);	
 }
 
-const TokenTypeT BINARY_CLASS_OP[BINARYT_NUMBER][4]=
+const TokenTypeT BINARY_CLASS_OP[][4]=
 {
 	{OP_OR, UNDEFINED, UNDEFINED, UNDEFINED},
 	{OP_AND, UNDEFINED, UNDEFINED, UNDEFINED},
@@ -67,6 +81,9 @@ const TokenTypeT DECL_SPEC[] =
 
 #define TYPESPEC_BEGIN  0
 #define TYPESPEC_END  4
+#define MAX_NESTING 4096
+#define MAX_DIAGNOSTICS 100
+#define ORDER_STEP (1ULL << 32)
 
 const bool withoutMove = false, specifierQualifier = false;
 
@@ -86,12 +103,27 @@ static bool maybeUnaryOp(const Token& look)
 	return isUnary;
 }
 
-bool Parser::maybeBinaryOp(BinaryT btype)
+static const size_t TOKEN_COUNT = 0
+#define TOKEN(name, text) + 1
+#include "tokenTypes.def"
+#undef TOKEN
+;
+
+/* per token precedence: 0 for a token that is no binary operator, otherwise its row in BINARY_CLASS_OP + 1 */
+static vector<unsigned char> buildBinaryPrecedence()
+{
+	vector<unsigned char> precedence(TOKEN_COUNT, 0);
+	for (int btype = 0; btype < (int)(sizeof(BINARY_CLASS_OP) / sizeof(BINARY_CLASS_OP[0])); btype++)
+		for (int i = 0; i < 4 && BINARY_CLASS_OP[btype][i] != UNDEFINED; i++)
+			precedence[BINARY_CLASS_OP[btype][i]] = btype + 1;
+	return precedence;
+}
+
+static const vector<unsigned char> BINARY_PRECEDENCE = buildBinaryPrecedence();
+
+static int binaryPrecedence(const Token& op)
 {
-	bool isBinary = false;
-	for (int i = 0; i < 4 && !isBinary; i++)
-		isBinary = look == BINARY_CLASS_OP[btype][i];
-	return isBinary;
+	return BINARY_PRECEDENCE[op.type];
 }
 
 static bool maybeVar(const Token& look)
@@ -109,9 +141,9 @@ static Token getOpToken(const Token look)
 	Token curr = look;
 	switch(look)
 	{
-		case OP_COLON : curr.text = "?:"; break;
-		case OP_R_SQUARE : curr.text = "[]"; break;
-		default : curr.text = "()";
+		case OP_COLON : curr.setText("?:"); break;
+		case OP_R_SQUARE : curr.setText("[]"); break;
+		default : curr.setText("()");
 	}
 	return curr;
 }
@@ -120,7 +152,7 @@ static Token getIncDecOp(const Token look, bool isPost)
 {
 	Token curr = look;
 	if (look == OP_INC || look == OP_DEC)
-		curr.text = isPost ? "x" + curr.text : curr.text + "x";
+		curr.setText(isPost ? "x" + curr.getText() : curr.getText() + "x");
 	return curr;
 }
 
@@ -133,14 +165,14 @@ static bool maybeDecl(const Token& look)
 	return isDecl;
 }
 
-void Parser::pushTable(SymbolTable* table)
+void Parser::pushTable()
 {
-	symTableStack.push(table);
+	symTableStack.push();
 }
 
-void Parser::popTable()
+SymbolTable* Parser::popTable()
 {
-	symTableStack.pop();
+	return symTableStack.pop();
 }
 
 Symbol* Parser::get()
@@ -158,9 +190,11 @@ bool Parser::findInCurrTable(const Token& name)
 	return symTableStack.hasSymbolInCurrTable(name);
 }
 
-Parser::Parser(Scanner &scan) : scanner(scan)
+Parser::Parser(TokenStream &scan, bool pretokenize) : scanner(scan), tokenIndex(0), isPretokenized(pretokenize), lexError(NULL), isIncremental(false), nesting(0), replacedBytes(0), threads(0), isDeferring(false)
 {
 	isFuncDif = false;
+	ArenaScope scope(arena);
+	symTableStack.resetGlobal();
 };
 
 SymbolTable* Parser::getGlobalTable()
@@ -168,7 +202,30 @@ SymbolTable* Parser::getGlobalTable()
 	return symTableStack.getGlobal();
 }
 
-Parser::~Parser(){};
+/* the folded nodes are the parser's like the rest of the trees, whichever thread made those */
+void Parser::foldConstants()
+{
+	ArenaScope scope(arena);
+	SourceScope sourceScope(scanner.getSource());
+	SymbolTable* global = getGlobalTable();
+	for (size_t i = 0; i < global->size(); i++)
+		global->at(i)->fold();
+}
+
+/* a worker over one function body: its tokens are copied, the global table is shared read only */
+Parser::Parser(Parser& owner, const BodyT& body) : scanner(owner.scanner), tokenIndex(0), isPretokenized(true), lexError(NULL), isIncremental(false), nesting(0), replacedBytes(0), threads(0), isDeferring(false)
+{
+	isFuncDif = false;
+	tokens.assign(owner.tokens.begin() + body.begin, owner.tokens.begin() + body.end);
+	symTableStack.shareGlobal(owner.symTableStack.getGlobal(), body.stamp);
+}
+
+Parser::~Parser()
+{
+	delete lexError;
+	for (size_t i = 0; i < arenas.size(); i++)
+		delete arenas[i];
+}
 
 void Parser::match(TokenTypeT type, bool toMove = true)
 {
@@ -181,28 +238,273 @@ void Parser::match(TokenTypeT type, bool toMove = true)
 
 void Parser::exception(string error)
 {
-	throw ParserException(look.line, look.col, error);
+	throw ParserException(look.getLine(), look.getCol(), error);
 }
 
+/*
+	tokens holds either the whole translation unit (pretokenized mode) or
+	just the lookahead that peek pulled from the scanner; a lexical error
+	found while pretokenizing is raised when the parser reaches it
+*/
 void Parser::move()
 {
-	look = scanner.next();
+	if (tokenIndex < tokens.size())
+		look = tokens[tokenIndex++];
+	else if (isPretokenized)
+	{
+		if (lexError != NULL)
+			throw *lexError;
+	}
+	else
+	{
+		tokens.clear();
+		tokenIndex = 0;
+		look = scanner.next();
+	}
+}
+
+const Token& Parser::peek(size_t k)
+{
+	while (tokenIndex + k > tokens.size())
+	{
+		if (isPretokenized)
+		{
+			if (lexError != NULL)
+				throw *lexError;
+			return tokens.back();
+		}
+		tokens.push_back(scanner.next());
+	}
+	return tokens[tokenIndex + k - 1];
 }
 
 bool Parser::isMainDif()
 {
-	return symTableStack.getSymbol(Token(IDENTIFIER, "main", "main"))->isInit();
+	return symTableStack.getSymbol(Token(IDENTIFIER, "main"))->isInit();
 }
 
 void Parser::parse()
 {
-	move();
-	parseTranslationUnit();
+	ArenaScope scope(arena);
+	SourceScope sourceScope(scanner.getSource());
+	nesting = 0;
+	if (isPretokenized)
+	{
+		try
+		{
+			scanner.tokenize(tokens);
+		}
+		catch (ScannerException &error)
+		{
+			lexError = new ScannerException(error);
+		}
+	}
+	if (threads > 0 && !isIncremental && parseInParallel())
+		return;
+	clearCompounds();
+	diagnostics.clear();
+	try
+	{
+		move();
+		parseTranslationUnit();
+	}
+	catch (ScannerException& error)
+	{
+		diagnostics.push_back(error.text());
+	}
+	if (isIncremental)
+		symTableStack.getGlobal()->settle();
+	if (!diagnostics.empty())
+		throw DiagnosticsException(diagnostics);
+}
+
+/*
+	two phases: the top-level declarations are parsed with every function
+	body skipped by brace matching, then a pool of workers parses the
+	bodies, each a Parser of its own over the body's tokens that sees the
+	global table as it was where the body starts. Any error sends the unit
+	back to the serial parse, so diagnostics come out exactly as before
+*/
+bool Parser::parseInParallel()
+{
+	bool isClean = true;
+	bodies.clear();
+	symTableStack.getGlobal()->keepVersions(true);
+	isDeferring = true;
+	try
+	{
+		clearCompounds();
+		diagnostics.clear();
+		move();
+		parseTranslationUnit();
+	}
+	catch (CompilerException&)
+	{
+		isClean = false;
+	}
+	isDeferring = false;
+	if (isClean && diagnostics.empty() && parseBodies())
+	{
+		symTableStack.getGlobal()->keepVersions(false);
+		return true;
+	}
+	restart();
+	return false;
+}
+
+void Parser::restart()
+{
+	symTableStack.resetGlobal();
+	tokenIndex = 0;
+	nesting = 0;
+	binaryOperands.clear();
+	binaryOps.clear();
+	isFuncDif = false;
+	bodies.clear();
+}
+
+void Parser::deferBody(Symbol* sym)
+{
+	BodyT body = {tokenIndex - 1, 0, sym, symTableStack.getGlobal()->getStamp()};
+	Token brace = look;
+	int depth = 0;
+	do
+	{
+		if (look == L_BRACE)
+			depth++;
+		else if (look == R_BRACE)
+			depth--;
+		move();
+	}
+	while (depth > 0 && look != EOF_TOKEN);
+	if (depth > 0)
+		exception("expected }");
+	body.end = tokenIndex - 1;
+	bodies.push_back(body);
+	symTableStack.init(sym, new StmtCompound(brace, NULL, NULL));
+}
+
+bool Parser::parseBodies()
+{
+	vector<StmtNode*> results(bodies.size(), NULL);
+	atomic<size_t> next(0);
+	atomic<bool> isClean(true);
+	size_t workers = min((size_t)threads, bodies.size());
+	while (arenas.size() < workers)
+		arenas.push_back(new Arena());
+	vector<thread> pool;
+	for (size_t i = 0; i < workers; i++)
+		pool.push_back(thread(&Parser::runBodies, this, arenas[i], scanner.getSource(), &next, &results, &isClean));
+	for (size_t i = 0; i < pool.size(); i++)
+		pool[i].join();
+	if (!isClean)
+		return false;
+	for (size_t i = 0; i < bodies.size(); i++)
+		bodies[i].sym->init(results[i]);
+	return true;
+}
+
+void Parser::runBodies(Arena* arena, const Source_buffer* source, atomic<size_t>* next, vector<StmtNode*>* results, atomic<bool>* isClean)
+{
+	ArenaScope scope(*arena);
+	SourceScope sourceScope(source);
+	for (size_t i = (*next)++; i < bodies.size() && *isClean; i = (*next)++)
+	{
+		Parser worker(*this, bodies[i]);
+		(*results)[i] = worker.parseBody(bodies[i]);
+		if ((*results)[i] == NULL)
+			*isClean = false;
+	}
+}
+
+/* NULL unless the body parsed without errors and ended exactly at its closing brace */
+StmtNode* Parser::parseBody(const BodyT& body)
+{
+	try
+	{
+		move();
+		StmtNode* result = parseCompoundStmt(static_cast<SymTypeFunc*>(body.sym->getType()));
+		return diagnostics.empty() && tokenIndex == tokens.size() ? result : NULL;
+	}
+	catch (...)
+	{
+		return NULL;
+	}
+}
+
+Parser::RecoveryT Parser::mark()
+{
+	RecoveryT state = {symTableStack.size(), compoundDepth(), binaryOperands.size(), binaryOps.size(), nesting};
+	return state;
+}
+
+/*
+	panic mode: the error is recorded, the parser state is unwound to the
+	statement or declaration that failed and tokens are skipped up to a ';'
+	or past a balanced block. At the top level a declaration specifier
+	outside any brackets ends the skip as well. Each token is skipped at
+	most once and the number of errors is capped, so a broken file costs
+	no more than a clean one
+*/
+void Parser::recover(const CompilerException& error, const RecoveryT& state, bool isTopLevel)
+{
+	string text = error.text();
+	if (diagnostics.empty() || diagnostics.back() != text)
+		diagnostics.push_back(text);
+	if (diagnostics.size() >= MAX_DIAGNOSTICS)
+	{
+		diagnostics.push_back("too many errors, stopping");
+		throw DiagnosticsException(diagnostics);
+	}
+	while (symTableStack.size() > state.tables)
+		popTable();
+	while (compoundDepth() > state.compounds)
+		popCompound();
+	binaryOperands.resize(state.operands);
+	binaryOps.resize(state.ops);
+	nesting = state.nesting;
+	if (isTopLevel)
+		isFuncDif = false;
+
+	int braces = 0, parens = 0;
+	bool isMoved = false;
+	while (look != EOF_TOKEN)
+	{
+		if (look == SEMICOLON && braces == 0)
+		{
+			move();
+			return;
+		}
+		if (look == R_BRACE)
+		{
+			if (braces == 0)
+			{
+				if (isTopLevel)
+					move();
+				return;
+			}
+			move();
+			if (--braces == 0 && look != KW_ELSE)
+				return;
+			continue;
+		}
+		if (isTopLevel && isMoved && braces == 0 && parens == 0 && maybeDecl(look))
+			return;
+		if (look == L_BRACE)
+			braces++;
+		else if (look == L_PARENTHESIS)
+			parens++;
+		else if (look == R_PARENTHESIS && parens > 0)
+			parens--;
+		move();
+		isMoved = true;
+	}
 }
 
 void Parser::printTree()
 {
-	if (!symTableStack.hasSymbolInCurrTable(Token(IDENTIFIER, "main", "main")) || !isMainDif())
+	SourceScope scope(scanner.getSource());
+	if (!symTableStack.hasSymbolInCurrTable(Token(IDENTIFIER, "main")) || !isMainDif())
 		exception("expected function main definition");
 	symTableStack.print();
 }
@@ -221,9 +523,9 @@ ExprNode* Parser::constExpr()
 ExprNode* Parser::varExpr(SymbolTable* table = NULL)
 {
 	Token tok = look;
-	Symbol *sym = (table == NULL) ? get() : (*table)[tok.text];
+	Symbol *sym = (table == NULL) ? get() : (*table)[tok.textId];
 	if (sym == NULL)
-		exception(tok.text + " identifier is undefined");
+		exception(tok.getText() + " identifier is undefined");
 	move();
 	return new ExprVar(tok, sym);
 }
@@ -247,7 +549,6 @@ ExprNode* Parser::parsePrimaryExpr()
 ExprNode* Parser::parsePostfixExpr()
 {
 	ExprNode *post = NULL;
-	Token op = look;
 	post = parsePrimaryExpr();
 	bool isPostfixExpr = true;
 	while (isPostfixExpr)
@@ -287,18 +588,21 @@ ExprNode* Parser::parsePostfixExpr()
 					{
 						case OP_STRUCT_REFERENCE :
 							if (*post != STRUCT)
-								throw SemanticsException(op.line, op.col, err + "struct type");
+								throw SemanticsException(op.getLine(), op.getCol(), err + "struct type");
 							break;
 						default :
 							{
 							if (*post != POINTER || *static_cast<SymTypePointer*>(post->getType())->dereference() != STRUCT)
-								throw SemanticsException(op.line, op.col, err + "pointer type");
+								throw SemanticsException(op.getLine(), op.getCol(), err + "pointer type");
 							post = new ExprCast(static_cast<SymTypePointer*>(post->getType())->dereference(), post);
 							}
 					}
 
 					SymbolTable* table = post->getType()->getTable();//*post == POINTER ? static_cast<SymTypePointer*>(post->getType())->dereference()->getTable() : post->getTable();
-					post = new ExprFieldSelect(op, post, varExpr(table));
+					if (table == NULL)
+						throw SemanticsException(op.getLine(), op.getCol(), err + "complete struct type");
+					int field = table->indexOf(look.textId);
+					post = new ExprFieldSelect(op, post, varExpr(table), field);
 				}
 			break;
 
@@ -318,34 +622,72 @@ ExprNode* Parser::parsePostfixExpr()
 	return post;
 }
 
+/*
+	every nested operand passes through here, so this bounds the recursion
+	of deep expressions and of the tree walks over them. A level takes up
+	to about 1.2K of stack in a debug build, so the limit fits the 8M
+	stacks the compiler runs its threads on
+*/
+void Parser::enterNested()
+{
+	if (++nesting > MAX_NESTING)
+		exception("expression nested too deeply");
+}
+
 ExprNode* Parser::parseCastExpr()
 {
-	if (look != L_PARENTHESIS)
-		return parseUnaryExpr();
-	move();
-	if (!maybeDecl(look))
+	enterNested();
+	ExprNode* n;
+	if (look != L_PARENTHESIS || !maybeDecl(peek(1)))
+		n = parseUnaryExpr();
+	else
 	{
-		look = scanner.prev();
-		return parseUnaryExpr();
+		move();
+		SymType* type = parsePointer(parseTypeSpecifier());
+		match(R_PARENTHESIS);
+		n = new ExprCast(type, parseCastExpr());
+		n->setType(type);
 	}
-	SymType* type = parsePointer(parseTypeSpecifier());
-	match(R_PARENTHESIS);
-	ExprNode* n = new ExprCast(type, parseCastExpr());
-	n->setType(type);
+	--nesting;
 	return n;
 }
 
-ExprNode* Parser::parseBinaryExpr(BinaryT btype)
-{
-	ExprNode *lExpr = btype == MULTI_EXPR ? parseCastExpr() : parseBinaryExpr(BinaryT(btype + 1));
-	Token op = look;
-	while (maybeBinaryOp(btype))
+/*
+	precedence climbing over explicit stacks: an operator first reduces every
+	pending one that binds at least as tightly, so the nodes are built in the
+	order the per level recursion built them and all operators associate to
+	the left. A nested expression (in parentheses, arguments, subscripts)
+	works above the entries of the enclosing one, so the stacks are shared
+*/
+ExprNode* Parser::parseBinaryExpr()
+{
+	size_t base = binaryOps.size();
+	ExprNode* first = parseCastExpr();
+	int precedence = binaryPrecedence(look);
+	if (precedence == 0)
+		return first;
+	binaryOperands.push_back(first);
+	for (; precedence > 0; precedence = binaryPrecedence(look))
 	{
+		while (binaryOps.size() > base && binaryPrecedence(binaryOps.back()) >= precedence)
+			reduceBinary();
+		binaryOps.push_back(look);
 		move();
-		lExpr = new BinaryNode(op, lExpr, (btype == MULTI_EXPR ? parseCastExpr() : parseBinaryExpr(BinaryT(btype + 1))));
-		op = look;
+		binaryOperands.push_back(parseCastExpr());
 	}
-	return lExpr;
+	while (binaryOps.size() > base)
+		reduceBinary();
+	ExprNode* expr = binaryOperands.back();
+	binaryOperands.pop_back();
+	return expr;
+}
+
+void Parser::reduceBinary()
+{
+	ExprNode* rExpr = binaryOperands.back();
+	binaryOperands.pop_back();
+	binaryOperands.back() = new BinaryNode(binaryOps.back(), binaryOperands.back(), rExpr);
+	binaryOps.pop_back();
 }
 
 ExprNode* Parser::parseUnaryExpr()
@@ -354,7 +696,9 @@ ExprNode* Parser::parseUnaryExpr()
 	if (maybeUnaryOp(look)|| look == OP_INC || look == OP_DEC)
 	{
 		move();
+		enterNested();
 		ExprNode *node = (look == OP_DEC || look == OP_INC) ? parseUnaryExpr (): parseCastExpr();//UnaryExpr();
+		--nesting;
 		return new UnaryNode(getIncDecOp(op, false), node);
 	}
 	return parsePostfixExpr();
@@ -362,14 +706,17 @@ ExprNode* Parser::parseUnaryExpr()
 
 ExprNode* Parser::parseConditionalExpr()
 {
-	BinaryNode *lExpr = static_cast<BinaryNode*>(parseBinaryExpr(LOGIC_OR_EXPR));
+	BinaryNode *lExpr = static_cast<BinaryNode*>(parseBinaryExpr());
 	if (look != OP_QUEST)
 		return lExpr;
 	move();
 	ExprNode* rExpr = parseExpression();
 	Token op = getOpToken(look);
 	match(OP_COLON);
-	return new TernaryNode(op, lExpr, rExpr, parseConditionalExpr());
+	enterNested();
+	ExprNode* fExpr = parseConditionalExpr();
+	--nesting;
+	return new TernaryNode(op, lExpr, rExpr, fExpr);
 }
 
 ExprNode* Parser::parseAssignmentExpr()
@@ -521,9 +868,9 @@ StmtNode* Parser::parseCompoundStmt(SymType* funcType = NULL)
 {
 	Token op = look;
 	move();
-	SymbolTable* table = new SymbolTable();
-	pushTable(table);
-	if (table->getLevel() == 1)
+	pushTable();
+	/* a function's outermost block declares its parameters */
+	if (symTableStack.size() == 2)
 	{
 		vector<Symbol*> params = static_cast<SymTypeFunc*>(funcType)->getParams();
 		for(int i = 0; i < params.size(); i++)
@@ -535,30 +882,44 @@ StmtNode* Parser::parseCompoundStmt(SymType* funcType = NULL)
 		}
 	}
 	vector<StmtNode*> compounds;
-	StmtCompound* c = new StmtCompound(op, table, funcType);
+	StmtCompound* c = new StmtCompound(op, NULL, funcType);
 	addCompound(c);
 	while (look != R_BRACE && look != EOF_TOKEN)
         {
-		if (maybeDecl(look))
+		RecoveryT state = mark();
+		try
+		{
+			if (maybeDecl(look))
 			{
-				size_t beforeSize = table->size();
+				SymbolTable* table = symTableStack.getTable();
+				size_t beforeSize = table != NULL ? table->size() : 0;
 				parseDeclaration();
 
-				for (int i = beforeSize; i < table->size(); i++)
+				table = symTableStack.getTable();
+				for (size_t i = beforeSize; table != NULL && i < table->size(); i++)
 				{
 					Symbol* var = table->at(i);
 					if (!var->isInit() || !var->isVar())
 						continue;
-					ExprNode* assignment = new ExprAssignment(Token(OP_ASSIGN, "=", "="), new ExprVar(var->getTokenName(), var), static_cast<ExprNode*>(static_cast<SymVar*>(var)->getInitializer()), *var->getType() != ARRAY);
-					c->addStmt(new StmtExpr(Token(SEMICOLON, ";", ";"), assignment));
+					ExprNode* assignment = new ExprAssignment(Token(OP_ASSIGN), new ExprVar(var->getTokenName(), var), static_cast<ExprNode*>(static_cast<SymVar*>(var)->getInitializer()), *var->getType() != ARRAY);
+					c->addStmt(new StmtExpr(Token(SEMICOLON), assignment));
 				}
 				continue;
 			}
-		if (look != R_BRACE)
-			c->addStmt(parseStmt(funcType));
+			if (look != R_BRACE)
+				c->addStmt(parseStmt(funcType));
+		}
+		catch (ParserException& error)
+		{
+			recover(error, state, false);
+		}
+		catch (SemanticsException& error)
+		{
+			recover(error, state, false);
+		}
 	}
 	match(R_BRACE);
-	popTable();
+	c->setTable(popTable());
 	popCompound();
 	return c;
 }
@@ -638,7 +999,10 @@ bool Parser::parseInitDeclarator(SymType* type)
 			exception("expected ;");
 		if (*sym == FUNCTION)
 		{
-			symTableStack.init(sym, parseCompoundStmt(static_cast<SymTypeFunc*>(sym->getType())));
+			if (isDeferring)
+				deferBody(sym);
+			else
+				symTableStack.init(sym, parseCompoundStmt(static_cast<SymTypeFunc*>(sym->getType())));
 			isFuncDif = true;
 		}
 		else
@@ -657,7 +1021,7 @@ SymType* Parser::parsePointer(SymType* type)
 	while (look == OP_ASTERISK)
 	{
 		move();
-		pointer = new SymTypePointer(pointer);
+		pointer = SymTypePointer::canonical(pointer);
 	}
 	return pointer;
 }
@@ -727,7 +1091,7 @@ Symbol* Parser::parseGeneralDirectDeclarator(SymType* type, DeclaratorT decl)
 			{
 				if (decl == DIRECT_SIMPLE)
 					exception("expected direct declarator");
-				sym = new SymVarParam(Token(look.line, look.col), parseFunc(type), NULL);
+				sym = new SymVarParam(Token(look.offset), parseFunc(type), NULL);
 				return sym;
 			}
 			match(R_PARENTHESIS);
@@ -738,7 +1102,7 @@ Symbol* Parser::parseGeneralDirectDeclarator(SymType* type, DeclaratorT decl)
 		move();
 		if (sym == NULL)
 		{
-			sym = new SymVarParam(Token(look.line, look.col), parseArray(type), NULL);
+			sym = new SymVarParam(Token(look.offset), parseArray(type), NULL);
 			continue;
 		}
 		static_cast<SymVar*>(sym)->assignType(parseArray(type), isP);
@@ -796,12 +1160,230 @@ ExprNode* Parser::parseInitializerList(SymType* type)
 void Parser::parseTranslationUnit()
 {
 	while(look != EOF_TOKEN)
+	{
+		RecoveryT state = mark();
+		try
+		{
+			if (isIncremental)
+			{
+				declarations.push_back(DeclarationT());
+				parseRecordedDeclaration(declarations.back(), declarations.size() * ORDER_STEP);
+			}
+			else
+				parseDeclaration();
+		}
+		catch (ParserException& error)
+		{
+			recover(error, state, true);
+		}
+		catch (SemanticsException& error)
+		{
+			recover(error, state, true);
+		}
+	}
+}
+
+/* the global table is kept in declaration order, so one declaration can be parsed again at its place */
+void Parser::setIncremental()
+{
+	isIncremental = isPretokenized = true;
+	symTableStack.getGlobal()->keepOrder();
+}
+
+/* the declaration sees just the globals put before its order */
+void Parser::parseRecordedDeclaration(DeclarationT& decl, unsigned long long order)
+{
+	SymbolTable* global = symTableStack.getGlobal();
+	size_t bytes = arena.getStats().bytes;
+	decl.begin = tokenIndex - 1;
+	decl.order = order;
+	global->setPlace(order);
+	symTableStack.record(&decl.symbols, &decl.lookups);
+	try
+	{
 		parseDeclaration();
+	}
+	catch (...)
+	{
+		symTableStack.record(NULL, NULL);
+		global->setPlace(SymbolTable::LAST_PLACE);
+		throw;
+	}
+	symTableStack.record(NULL, NULL);
+	global->setPlace(SymbolTable::LAST_PLACE);
+	decl.end = tokenIndex - 1;
+	decl.signature = getSignature(decl.begin, decl.end);
+	decl.bytes = arena.getStats().bytes - bytes;
+}
+
+/* the trees of a removed declaration stay in the arena until the next full parse */
+void Parser::removeDeclaration(const DeclarationT& decl, vector<unsigned int>& names)
+{
+	SymbolTable* global = symTableStack.getGlobal();
+	for (size_t i = decl.symbols.size(); i > 0; i--)
+	{
+		global->removePut(decl.symbols[i - 1], decl.order);
+		names.push_back(decl.symbols[i - 1]->getNameId());
+	}
+	replacedBytes += decl.bytes;
+}
+
+/*
+	hash of a declaration's tokens with function bodies left out: equal
+	signatures mean the declaration introduces the same globals
+*/
+unsigned long long Parser::getSignature(size_t begin, size_t end)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	for (size_t i = begin; i < end; i++)
+	{
+		if (tokens[i] == L_BRACE && i > begin && tokens[i - 1] == R_PARENTHESIS)
+		{
+			for (int depth = 0; i < end; i++)
+			{
+				depth += tokens[i] == L_BRACE ? 1 : tokens[i] == R_BRACE ? -1 : 0;
+				if (depth == 0)
+					break;
+			}
+			continue;
+		}
+		const Token& t = tokens[i];
+		unsigned long long fields[3] = {(unsigned long long)t.type, t.textId, 0};
+		memcpy(&fields[2], &t.val, sizeof(t.val));
+		for (int k = 0; k < 3; k++)
+			hash = (hash ^ fields[k]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+/*
+	tokens [first, last) were replaced and the offsets after them moved by
+	shift bytes. The declarations the edit touches are taken out of the
+	global table and parsed again at their order, and parsing stops at the
+	first old declaration boundary past the edit. Later declarations are
+	kept unless they look up a global that the edit may have changed, i.e.
+	one declared by a re-parsed declaration whose signature differs; those
+	are parsed again at their own order. The rest of the global table is
+	left alone, so besides moving the tokens an edit costs what it touches.
+	Running out of orders or moving a boundary throws, and the caller falls
+	back to a full parse
+*/
+size_t Parser::update(size_t first, size_t last, const vector<Token>& replacement, long shift)
+{
+	ArenaScope scope(arena);
+	SourceScope sourceScope(scanner.getSource());
+	nesting = 0;
+	diagnostics.clear();
+	clearCompounds();
+	long delta = (long)replacement.size() - (long)(last - first);
+	if (delta > 0)
+		tokens.insert(tokens.begin() + last, delta, Token());
+	else
+		tokens.erase(tokens.begin() + first + replacement.size(), tokens.begin() + last);
+	copy(replacement.begin(), replacement.end(), tokens.begin() + first);
+	for (size_t i = first + replacement.size(); i < tokens.size(); i++)
+		tokens[i].offset += shift;
+
+	size_t i = lower_bound(declarations.begin(), declarations.end(), first, endsBefore) - declarations.begin();
+	size_t k = i, reparsed = 0, reused = 0;
+	vector<DeclarationT> parsed;
+	vector<unsigned long long> oldSignatures, newSignatures, orders;
+	vector<unsigned int> names;
+	for (; k < declarations.size() && declarations[k].begin < last; k++)
+	{
+		removeDeclaration(declarations[k], names);
+		oldSignatures.push_back(declarations[k].signature);
+		orders.push_back(declarations[k].order);
+	}
+
+	unsigned long long previous = i > 0 ? declarations[i - 1].order : 0;
+	tokenIndex = i < declarations.size() ? declarations[i].begin : declarations.empty() ? 0 : declarations.back().end;
+	move();
+	while (look != EOF_TOKEN)
+	{
+		size_t at = tokenIndex - 1;
+		if (at >= first + replacement.size())
+		{
+			size_t oldAt = at - delta;
+			for (; k < declarations.size() && declarations[k].begin < oldAt; k++)
+			{
+				removeDeclaration(declarations[k], names);
+				oldSignatures.push_back(declarations[k].signature);
+				orders.push_back(declarations[k].order);
+			}
+			if (k < declarations.size() && declarations[k].begin == oldAt)
+				break;
+		}
+		unsigned long long order, bound = k < declarations.size() ? declarations[k].order : SymbolTable::LAST_PLACE;
+		while (reused < orders.size() && orders[reused] <= previous)
+			reused++;
+		if (reused < orders.size())
+			order = orders[reused++];
+		else if (bound - previous > ORDER_STEP)
+			order = previous + ORDER_STEP;
+		else if (bound - previous > 1)
+			order = previous + (bound - previous) / 2;
+		else
+			exception("no order left between declarations");
+		parsed.push_back(DeclarationT());
+		parseRecordedDeclaration(parsed.back(), order);
+		newSignatures.push_back(parsed.back().signature);
+		previous = order;
+		reparsed++;
+	}
+	for (; look == EOF_TOKEN && k < declarations.size(); k++)
+	{
+		removeDeclaration(declarations[k], names);
+		oldSignatures.push_back(declarations[k].signature);
+	}
+	declarations.erase(declarations.begin() + i, declarations.begin() + k);
+	declarations.insert(declarations.begin() + i, parsed.begin(), parsed.end());
+	for (k = i + parsed.size(); k < declarations.size(); k++)
+	{
+		declarations[k].begin += delta;
+		declarations[k].end += delta;
+	}
+
+	set<unsigned int> changed;
+	if (oldSignatures != newSignatures)
+	{
+		changed.insert(names.begin(), names.end());
+		for (k = i; k < i + parsed.size(); k++)
+			for (size_t j = 0; j < declarations[k].symbols.size(); j++)
+				changed.insert(declarations[k].symbols[j]->getNameId());
+	}
+	for (k = i + parsed.size(); k < declarations.size() && !changed.empty(); k++)
+	{
+		DeclarationT& decl = declarations[k];
+		bool isAffected = false;
+		for (size_t j = 0; j < decl.lookups.size() && !isAffected; j++)
+			isAffected = changed.count(decl.lookups[j]) != 0;
+		if (!isAffected)
+			continue;
+		names.clear();
+		removeDeclaration(decl, names);
+		DeclarationT next;
+		tokenIndex = decl.begin;
+		move();
+		parseRecordedDeclaration(next, decl.order);
+		if (next.end != decl.end)
+			exception("declaration boundary moved");
+		swap(decl, next);
+		reparsed++;
+		for (size_t j = 0; j < decl.symbols.size(); j++)
+			changed.insert(decl.symbols[j]->getNameId());
+	}
+	symTableStack.getGlobal()->settle();
+	tokenIndex = tokens.size();
+	look = tokens.back();
+	if (!diagnostics.empty())
+		throw DiagnosticsException(diagnostics);
+	return reparsed;
 }
 
-map<string, Symbol*> Parser::parseStructDeclaration()
+vector<Symbol*> Parser::parseStructDeclaration()
 {
-	map<string, Symbol*> declaration;
+	vector<Symbol*> declaration;
 	SymType* symType = parseTypeSpecifier();
 	Symbol* sym = NULL;
 	while (look != SEMICOLON)
@@ -811,9 +1393,10 @@ map<string, Symbol*> Parser::parseStructDeclaration()
 			exception("expected declarator");
 		if (*sym->getType() == FUNCTION)
 			exception("function cannot be member of struct");
-		if (declaration[sym->getName()] != NULL)
-			exception("struct member redefinition");
-		declaration[sym->getName()] = sym;
+		for (size_t i = 0; i < declaration.size(); i++)
+			if (declaration[i]->getNameId() == sym->getNameId())
+				exception("struct member redefinition");
+		declaration.push_back(sym);
 		if (look == OP_COMMA)
 			move();
 	}
@@ -826,14 +1409,14 @@ SymbolTable* Parser::parseStructDeclarationList()
 	SymbolTable* declList = new SymbolTable();
 	while (look != R_BRACE)
 	{
-		map<string ,Symbol*> decl = parseStructDeclaration();
+		vector<Symbol*> decl = parseStructDeclaration();
 		if (decl.size() == 0)
 			exception("expected }");
-		for (map<string ,Symbol*>::iterator i = decl.begin(); i != decl.end(); i++)
+		for (size_t i = 0; i < decl.size(); i++)
 		{
-			if ((*declList)[i->second->getName()] != NULL)
+			if ((*declList)[decl[i]->getNameId()] != NULL)
 				exception("struct member redefinition");
-			declList->putSymbol(i->second);
+			declList->putSymbol(decl[i]);
 		}
 	}
 	if (declList->size() == 0)
@@ -844,7 +1427,14 @@ SymbolTable* Parser::parseStructDeclarationList()
 SymType* Parser::parseStruct()
 {
 	Token name = look;
-	name.text = "struct " + name.text;
+	name.setText("struct " + name.getText());
+	/* only a definition or a lone "struct tag;" declares a tag in this scope, any other use names the visible one */
+	Symbol* visible = look == IDENTIFIER && peek(1) != L_BRACE && peek(1) != SEMICOLON ? symTableStack.findSymbol(name) : NULL;
+	if (visible != NULL && *visible == STRUCT)
+	{
+		move();
+		return static_cast<SymTypeStruct*>(visible);
+	}
 	SymTypeStruct *_struct = new SymTypeStruct(name);
 	if (look == IDENTIFIER)
 	{
@@ -864,20 +1454,29 @@ SymType* Parser::parseStruct()
 SymbolTable* Parser::parseEnumeratorList()
 {
 	SymbolTable* l = new SymbolTable();
-	int index = 0;
+	int index = 0, count = 0;
 	while (look != R_BRACE)
 	{
 		Token name = look;
 		match(IDENTIFIER);
+		if (look == OP_ASSIGN)
+		{
+			move();
+			ExprNode* value = parseConditionalExpr()->fold();
+			if (!value->isConst() || *value != INT)
+				exception("enumerator value must be an integer constant");
+			index = value->getToken().intValue();
+		}
 		Symbol* s = new SymTypeEnumConst(name, index++, NULL);
 		pushSymbol(s);
 		l->putSymbol(s);
-		name = look;
-		move();
-		if (name != OP_COMMA && look != R_BRACE)
+		++count;
+		if (look == OP_COMMA)
+			move();
+		else if (look != R_BRACE)
 			exception("expected }");
 	}
-	if (index == 0)
+	if (count == 0)
 		exception("C requires that a enum has at least one member");
 	return l;
 }
@@ -885,7 +1484,7 @@ SymbolTable* Parser::parseEnumeratorList()
 SymType* Parser::parseEnum()
 {
 	Token name = look;
-	name.text = "enum " + name.text;
+	name.setText("enum " + name.getText());
 	SymTypeEnum *_enum = new SymTypeEnum(name);
 	if (look == IDENTIFIER)
 	{
@@ -1,8 +1,9 @@
 #ifndef PARSER_H
 #define PARSER_H
 
-#include "node.h"
+#include "flatTree.h"
 #include <stack>
+#include <atomic>
 
 class Parser
 {
@@ -15,33 +16,56 @@ private:
 		DIRECT_BOTH,
 	}DeclaratorT;
 
-	typedef enum
+	typedef struct
+	{
+		size_t begin, end, bytes;
+		unsigned long long signature, order;
+		vector<Symbol*> symbols;
+		vector<unsigned int> lookups;
+	}DeclarationT;
+
+	typedef struct
+	{
+		size_t tables, compounds, operands, ops;
+		int nesting;
+	}RecoveryT;
+
+	typedef struct
 	{
-		LOGIC_OR_EXPR,
-		LOGIC_AND_EXPR,
-		INCLUSIVE_EXPR,
-		EXCLUSIVE_EXPR,
-		AND_EXPR,
-		EQUAL_EXPR,
-		RELATION_EXPR,
-		SHIFT_EXPR,
-		ADD_EXPR,
-		MULTI_EXPR,
-	}BinaryT;
-
-	#define BINARYT_NUMBER 10
+		size_t begin, end;
+		Symbol* sym;
+		unsigned int stamp;
+	}BodyT;
 
 	Token look;
-	Scanner &scanner;
+	TokenStream &scanner;
+	vector<Token> tokens;
+	size_t tokenIndex;
+	bool isPretokenized;
+	ScannerException* lexError;
+	Arena arena;
 	SymbolTableStack symTableStack;
+	vector<ExprNode*> binaryOperands;
+	vector<Token> binaryOps;
+	FlatTree flat;
 	bool isFuncDif;
+	bool isIncremental;
+	int nesting;
+	vector<DeclarationT> declarations;
+	size_t replacedBytes;
+	vector<string> diagnostics;
+	stack<StmtCompound*> compound;
+	vector<BodyT> bodies;
+	vector<Arena*> arenas;
+	unsigned int threads;
+	bool isDeferring;
 	
 	void match(TokenTypeT type, bool toMove);
 	void exception(string error);
 	void move();
-	bool maybeBinaryOp(BinaryT btype);
-	void pushTable(SymbolTable* table);
-	void popTable();
+	const Token& peek(size_t k);
+	void pushTable();
+	SymbolTable* popTable();
 	Symbol* get();
 	void pushSymbol(Symbol* sym);
 	void binaryCheck(ExprNode* expr, const Token& op);
@@ -55,7 +79,24 @@ private:
 	ExprNode* constExpr();
 	vector<ExprNode*> parseArgmExpr(ExprNode*);
 	ExprNode* varExpr(SymbolTable* table);
-	ExprNode* parseBinaryExpr(BinaryT btype);
+	ExprNode* parseBinaryExpr();
+	void reduceBinary();
+	void enterNested();
+	RecoveryT mark();
+	void pushCompound(StmtCompound* com);
+	void popCompound();
+	StmtCompound* topCompound();
+	void clearCompounds();
+	size_t compoundDepth();
+	void addCompound(StmtCompound* com);
+	void deferBody(Symbol* sym);
+	bool parseInParallel();
+	bool parseBodies();
+	void runBodies(Arena* arena, const Source_buffer* source, atomic<size_t>* next, vector<StmtNode*>* results, atomic<bool>* isClean);
+	StmtNode* parseBody(const BodyT& body);
+	void restart();
+	Parser(Parser& owner, const BodyT& body);
+	void recover(const CompilerException& error, const RecoveryT& state, bool isTopLevel);
 	ExprNode* parseParExpr();
 	ExprNode* parseCastExpr();
 
@@ -87,22 +128,37 @@ private:
 	ExprNode* parseInitializer(SymType* type);
 	SymType* parseStruct();
 	SymbolTable* parseStructDeclarationList();
-	map<string, Symbol*> parseStructDeclaration();
+	vector<Symbol*> parseStructDeclaration();
 	SymType* parseEnum();
 	SymbolTable* parseEnumeratorList();
 	void parseTranslationUnit();
+	void parseRecordedDeclaration(DeclarationT& decl, unsigned long long order);
+	void removeDeclaration(const DeclarationT& decl, vector<unsigned int>& names);
+	unsigned long long getSignature(size_t begin, size_t end);
+	static bool endsBefore(const DeclarationT& decl, size_t index){return decl.end < index;}
 	bool isMainDif();
 
 public:
 
-	Parser(Scanner &scan);
+	Parser(TokenStream &scan, bool pretokenize = false);
 	~Parser();
 	void parse();
+	void setIncremental();
+	void setParallel(unsigned int count){threads = count; isPretokenized = true;}
+	void flatten(){flat.flatten(symTableStack.getGlobal());}
+	size_t getFlatSize(){return flat.size();}
+	const vector<Token>& getTokens(){return tokens;}
+	size_t getDeclarationCount(){return declarations.size();}
+	size_t getReplacedBytes(){return replacedBytes;}
+	size_t getArenaBytes(){return arena.getStats().bytes;}
+	size_t update(size_t first, size_t last, const vector<Token>& replacement, long shift);
 	void printTree();
 	SymbolTable* getGlobalTable();
 	vector<Symbol*> getFunctions(){return symTableStack.getFunctions();}
 	vector<Symbol*> getVars(){return symTableStack.getVars();}
 	void initFunctionsAndVars(){symTableStack.initFunctionsAndVarsArray();}
+	void foldConstants();
+	const Source_buffer* getSource() const {return scanner.getSource();}
 };
 
 
@@ -0,0 +1,695 @@
+#include "preprocessor.h"
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <algorithm>
+#include <mutex>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define PATH_MAX _MAX_PATH
+#define realpath(name, resolved) _fullpath(resolved, name, PATH_MAX)
+#endif
+
+#define MAX_INCLUDE_DEPTH 200
+
+/*
+	a file as the preprocessor sees it. A directive stays in tokens as its
+	OP_HASH token, whose value counts the tokens of the line after it and
+	whose length covers the line; a lexical error is an UNDEFINED token
+	indexing errors, so an error inside a skipped group never shows. The
+	offsets of an included file are already moved into its own range
+*/
+struct SourceFileT
+{
+	string dir;
+	Source_buffer* source;
+	vector<Token> tokens;
+	vector<ScannerException> errors;
+	struct stat status;
+	unsigned int guard;
+	bool isOnce, isGuardChecked;
+	once_flag lexFlag;
+};
+
+/* a file that changed is mapped again; its old version stays until clearIncludeCache, a compilation may still be reading it */
+static map<string, SourceFileT*> filesBySpelling, filesByPath;
+static vector<SourceFileT*> retiredFiles;
+static PreprocessorStatsT stats;
+static mutex filesLock;
+
+static string directoryOf(const string& path)
+{
+	size_t slash = path.find_last_of("/\\");
+	return slash == string::npos ? "" : path.substr(0, slash + 1);
+}
+
+static void fail(const Token& at, const string& error)
+{
+	throw ScannerException(at.getLine(), at.getCol(), error);
+}
+
+static ScannerException errorAt(const Source_buffer* source, size_t offset, const string& error)
+{
+	int line, col;
+	source->locate(offset, line, col);
+	return ScannerException(line, col, error);
+}
+
+static bool isLineStart(const char* data, size_t at)
+{
+	while (at > 0 && (data[at - 1] == ' ' || data[at - 1] == '\t' || data[at - 1] == '\v'))
+		at--;
+	return at == 0 || data[at - 1] == '\n';
+}
+
+static size_t lineEnd(const char* data, size_t from, size_t size)
+{
+	const char* eoln = static_cast<const char*>(memchr(data + from, '\n', size - from));
+	return eoln == NULL ? size : eoln - data;
+}
+
+static void pushError(SourceFileT& file, size_t offset, const ScannerException& error)
+{
+	Token marker(UNDEFINED);
+	marker.offset = offset;
+	marker.val.iValue = file.errors.size();
+	file.errors.push_back(error);
+	file.tokens.push_back(marker);
+}
+
+/* a directive line that ends in a backslash goes on to the next one */
+static size_t lexDirective(SourceFileT& file, Token hash)
+{
+	const char* data = file.source->begin();
+	size_t size = file.source->size(), at = file.tokens.size(), begin = hash.offset + 1, end;
+	file.tokens.push_back(hash);
+	for (;;)
+	{
+		end = lineEnd(data, begin, size);
+		bool isContinued = end > begin && data[end - 1] == '\\';
+		Scanner line(file.source, begin, isContinued ? end - 1 : end);
+		for (Token t = line.next(); t != EOF_TOKEN; t = line.next())
+			file.tokens.push_back(t);
+		if (!isContinued || end == size)
+			break;
+		begin = end + 1;
+	}
+	file.tokens[at].val.iValue = file.tokens.size() - at - 1;
+	file.tokens[at].length = end - hash.offset;
+	return end;
+}
+
+/*
+	a file without a '#' is lexed in one go (in parallel when it is big);
+	otherwise the scanner is stopped at every '#' and after an error it
+	goes on from the next line. Returns whether there was a '#'
+*/
+static bool lexFile(Scanner& scanner, SourceFileT& file)
+{
+	const char* data = file.source->begin();
+	size_t size = file.source->size();
+	if (size == 0 || memchr(data, '#', size) == NULL)
+	{
+		try
+		{
+			scanner.tokenize(file.tokens);
+		}
+		catch (ScannerException &error)
+		{
+			pushError(file, size, error);
+		}
+		return false;
+	}
+	for (;;)
+	{
+		size_t mark = file.tokens.size();
+		try
+		{
+			const Token& t = scanner.next();
+			if (t != OP_HASH)
+			{
+				file.tokens.push_back(t);
+				if (t == EOF_TOKEN)
+					return true;
+				continue;
+			}
+			if (!isLineStart(data, t.offset))
+				throw errorAt(file.source, t.offset, "stray '#' in program");
+			scanner.seek(lexDirective(file, t));
+		}
+		catch (ScannerException &error)
+		{
+			size_t at = min(scanner.getOffset() - 1, size);
+			file.tokens.resize(mark);
+			pushError(file, at, error);
+			scanner.seek(lineEnd(data, at, size));
+		}
+	}
+}
+
+static void lexInclude(SourceFileT* file)
+{
+	Scanner scanner(file->source, 0, file->source->size());
+	lexFile(scanner, *file);
+	size_t base = file->source->getBase();
+	for (size_t i = 0; i < file->tokens.size(); i++)
+		file->tokens[i].offset += base;
+	lock_guard<mutex> guard(filesLock);
+	++stats.lexedFiles;
+}
+
+static bool isSameFile(const struct stat& a, const struct stat& b)
+{
+	bool isSame = a.st_mtime == b.st_mtime && a.st_size == b.st_size && a.st_ino == b.st_ino && a.st_dev == b.st_dev;
+#ifndef _WIN32
+	isSame = isSame && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+#endif
+	return isSame;
+}
+
+/*
+	the same file reached by another spelling of its path is mapped only
+	once. Every include stats the file, so a process that keeps the cache
+	between compilations never reads a header that has changed since
+*/
+static SourceFileT* findFile(const string& dir, const string& name)
+{
+	string spelling = name[0] == '/' || name[0] == '\\' ? name : dir + name;
+	struct stat status;
+	if (stat(spelling.c_str(), &status) != 0)
+		return NULL;
+	lock_guard<mutex> guard(filesLock);
+	++stats.includes;
+	map<string, SourceFileT*>::iterator it = filesBySpelling.find(spelling);
+	if (it != filesBySpelling.end() && isSameFile(it->second->status, status))
+		return it->second;
+	char path[PATH_MAX];
+	if (realpath(spelling.c_str(), path) == NULL)
+		return NULL;
+	it = filesByPath.find(path);
+	if (it != filesByPath.end() && isSameFile(it->second->status, status))
+		return filesBySpelling[spelling] = it->second;
+	FILE* f = fopen(path, "r");
+	if (f == NULL)
+		return NULL;
+	if (it != filesByPath.end())
+		retiredFiles.push_back(it->second);
+	SourceFileT* file = new SourceFileT();
+	file->dir = directoryOf(path);
+	file->status = status;
+	file->source = new Source_buffer(f, false);
+	file->source->include();
+	file->guard = 0;
+	file->isOnce = file->isGuardChecked = false;
+	fclose(f);
+	++stats.mappedFiles;
+	return filesByPath[path] = filesBySpelling[spelling] = file;
+}
+
+PreprocessorStatsT getPreprocessorStats()
+{
+	lock_guard<mutex> guard(filesLock);
+	return stats;
+}
+
+/* drops every cached file, old versions too; no Preprocessor may be running */
+void clearIncludeCache()
+{
+	lock_guard<mutex> guard(filesLock);
+	for (map<string, SourceFileT*>::iterator it = filesByPath.begin(); it != filesByPath.end(); ++it)
+		retiredFiles.push_back(it->second);
+	Source_buffer::forgetIncludes();
+	for (size_t i = 0; i < retiredFiles.size(); i++)
+	{
+		delete retiredFiles[i]->source;
+		delete retiredFiles[i];
+	}
+	retiredFiles.clear();
+	filesByPath.clear();
+	filesBySpelling.clear();
+}
+
+/* #if arithmetic is done in long long; isLive is false where || && ?: skip the operand */
+static long long evalConditional(const vector<Token>& e, size_t& i, const Token& at, bool isLive);
+
+static long long evalUnary(const vector<Token>& e, size_t& i, const Token& at, bool isLive)
+{
+	const Token& t = e[i++];
+	switch (t.type)
+	{
+		case INT_CONST : return t.val.iValue;
+		case CHAR_CONST : return (unsigned char)t.strValue()[0];
+		case IDENTIFIER : return 0;
+		case OP_ADD : return evalUnary(e, i, at, isLive);
+		case OP_SUB : return -evalUnary(e, i, at, isLive);
+		case OP_NOT : return !evalUnary(e, i, at, isLive);
+		case OP_TILDA : return ~evalUnary(e, i, at, isLive);
+		case L_PARENTHESIS :
+		{
+			long long value = evalConditional(e, i, at, isLive);
+			if (e[i] != R_PARENTHESIS)
+				fail(at, "expected ) in #if");
+			i++;
+			return value;
+		}
+		default : fail(at, "expected expression in #if");
+	}
+	return 0;
+}
+
+static int binaryPriority(TokenTypeT op)
+{
+	switch (op)
+	{
+		case OP_OR : return 1;
+		case OP_AND : return 2;
+		case OP_BOR : return 3;
+		case OP_XOR : return 4;
+		case OP_AMP : return 5;
+		case OP_EQUAL : case OP_UNEQUAL : return 6;
+		case OP_LESS : case OP_GREATER : case OP_LESS_OR_EQUAL : case OP_GREATER_OR_EQUAL : return 7;
+		case OP_L_SHIFT : case OP_R_SHIFT : return 8;
+		case OP_ADD : case OP_SUB : return 9;
+		case OP_ASTERISK : case OP_DIV : case OP_MOD : return 10;
+		default : return 0;
+	}
+}
+
+static long long applyBinary(TokenTypeT op, long long a, long long b, const Token& at, bool isLive)
+{
+	unsigned long long x = a, y = b;
+	switch (op)
+	{
+		case OP_OR : return a || b;
+		case OP_AND : return a && b;
+		case OP_BOR : return a | b;
+		case OP_XOR : return a ^ b;
+		case OP_AMP : return a & b;
+		case OP_EQUAL : return a == b;
+		case OP_UNEQUAL : return a != b;
+		case OP_LESS : return a < b;
+		case OP_GREATER : return a > b;
+		case OP_LESS_OR_EQUAL : return a <= b;
+		case OP_GREATER_OR_EQUAL : return a >= b;
+		case OP_L_SHIFT : return (long long)(x << (y & 63));
+		case OP_R_SHIFT : return a >> (y & 63);
+		case OP_ADD : return (long long)(x + y);
+		case OP_SUB : return (long long)(x - y);
+		case OP_ASTERISK : return (long long)(x * y);
+		default : break;
+	}
+	if (b == 0)
+	{
+		if (isLive)
+			fail(at, "division by zero in #if");
+		return 0;
+	}
+	if (a == LLONG_MIN && b == -1)
+		return op == OP_DIV ? a : 0;
+	return op == OP_DIV ? a / b : a % b;
+}
+
+static long long evalBinary(const vector<Token>& e, size_t& i, const Token& at, bool isLive, int priority)
+{
+	long long left = evalUnary(e, i, at, isLive);
+	for (int p = binaryPriority(e[i].type); p >= priority; p = binaryPriority(e[i].type))
+	{
+		TokenTypeT op = e[i++].type;
+		bool isRightLive = isLive && !(op == OP_AND && left == 0) && !(op == OP_OR && left != 0);
+		long long right = evalBinary(e, i, at, isRightLive, p + 1);
+		left = applyBinary(op, left, right, at, isRightLive);
+	}
+	return left;
+}
+
+static long long evalConditional(const vector<Token>& e, size_t& i, const Token& at, bool isLive)
+{
+	long long condition = evalBinary(e, i, at, isLive, 1);
+	if (e[i] != OP_QUEST)
+		return condition;
+	i++;
+	long long a = evalConditional(e, i, at, isLive && condition != 0);
+	if (e[i] != OP_COLON)
+		fail(at, "expected : in #if");
+	i++;
+	long long b = evalConditional(e, i, at, isLive && condition == 0);
+	return condition != 0 ? a : b;
+}
+
+Preprocessor::Preprocessor(Scanner& _scanner, const string& filename) : scanner(_scanner), dir(directoryOf(filename)), tokenIndex(0),
+	error(NULL), isDone(false), includeDepth(0), directives(0), expansions(0), expansionHits(0)
+{
+}
+
+Preprocessor::~Preprocessor()
+{
+	delete error;
+}
+
+/*
+	the whole translation unit is preprocessed at once; an error ends the
+	output the way it ends the scanner's. A main file without directives
+	is passed through as it was lexed
+*/
+void Preprocessor::run()
+{
+	SourceScope scope(scanner.getSource());
+	SourceFileT file;
+	file.dir = dir;
+	file.source = scanner.getSource();
+	file.guard = 0;
+	file.isOnce = false;
+	file.isGuardChecked = true;
+	isDone = true;
+	try
+	{
+		if (!lexFile(scanner, file) && file.errors.empty())
+			tokens.swap(file.tokens);
+		else
+		{
+			process(file);
+			tokens.push_back(file.tokens.back());
+		}
+	}
+	catch (ScannerException &e)
+	{
+		error = new ScannerException(e);
+	}
+	lock_guard<mutex> guard(filesLock);
+	stats.expansions += expansions;
+	stats.expansionHits += expansionHits;
+}
+
+Token& Preprocessor::next()
+{
+	if (!isDone)
+		run();
+	if (tokenIndex < tokens.size())
+		return tokens[tokenIndex++];
+	if (error != NULL)
+		throw *error;
+	return tokens.back();
+}
+
+void Preprocessor::tokenize(vector<Token>& out)
+{
+	if (!isDone)
+		run();
+	if (out.empty() && tokenIndex == 0 && !tokens.empty())
+	{
+		out.swap(tokens);
+		tokens.push_back(out.back());
+	}
+	else
+		out.insert(out.end(), tokens.begin() + tokenIndex, tokens.end());
+	tokenIndex = tokens.size();
+	if (error != NULL)
+		throw *error;
+}
+
+void Preprocessor::process(SourceFileT& file)
+{
+	const vector<Token>& input = file.tokens;
+	bool isGuardTracked;
+	{
+		lock_guard<mutex> lock(filesLock);
+		isGuardTracked = !file.isGuardChecked;
+	}
+	GuardT guard = {isGuardTracked ? GUARD_UNKNOWN : GUARD_NONE, 0, conditions.size()};
+	size_t i = 0;
+	for (; i < input.size() && input[i] != EOF_TOKEN; i++)
+	{
+		const Token& t = input[i];
+		if (t == OP_HASH)
+		{
+			++directives;
+			directive(file, t, input.data() + i + 1, t.val.iValue, guard);
+			i += t.val.iValue;
+			continue;
+		}
+		if (guard.state == GUARD_UNKNOWN || guard.state == GUARD_CLOSED)
+			guard.state = GUARD_NONE;
+		if (!isActive())
+			continue;
+		if (t == UNDEFINED)
+			throw file.errors[t.val.iValue];
+		if (t == IDENTIFIER && !macros.empty())
+		{
+			map<unsigned int, MacroT>::iterator m = macros.find(t.textId);
+			if (m != macros.end())
+			{
+				expand(m->second, t);
+				continue;
+			}
+		}
+		tokens.push_back(t);
+	}
+	if (conditions.size() != guard.depth)
+		fail(input[min(i, input.size() - 1)], "unterminated conditional directive");
+	if (isGuardTracked)
+	{
+		lock_guard<mutex> lock(filesLock);
+		file.guard = guard.state == GUARD_CLOSED ? guard.name : 0;
+		file.isGuardChecked = true;
+	}
+}
+
+/*
+	inside a skipped group only the conditional directives count. The
+	include guard is an #ifndef that opens the file and whose #endif
+	closes it with nothing but directives in between
+*/
+void Preprocessor::directive(SourceFileT& file, const Token& hash, const Token* args, size_t count, GuardT& guard)
+{
+	if (count == 0)
+		return;
+	const string& name = args[0].getText();
+	const Token* rest = args + 1;
+	size_t n = count - 1;
+	if (guard.state == GUARD_UNKNOWN)
+	{
+		guard.state = name == "ifndef" && n > 0 && rest[0] == IDENTIFIER ? GUARD_OPEN : GUARD_NONE;
+		guard.name = guard.state == GUARD_OPEN ? rest[0].textId : 0;
+	}
+	else if (guard.state == GUARD_CLOSED || (guard.state == GUARD_OPEN && conditions.size() == guard.depth + 1 && (name == "elif" || name == "else")))
+		guard.state = GUARD_NONE;
+
+	if (name == "ifdef" || name == "ifndef")
+	{
+		if (isActive() && (n == 0 || rest[0] != IDENTIFIER))
+			fail(hash, "expected macro name");
+		pushCondition(isActive() && (macros.count(rest[0].textId) != 0) == (name == "ifdef"));
+		return;
+	}
+	if (name == "if")
+	{
+		pushCondition(isActive() && evaluate(hash, rest, n));
+		return;
+	}
+	if (name == "elif" || name == "else" || name == "endif")
+	{
+		if (conditions.size() == guard.depth)
+			fail(hash, "#" + name + " without #if");
+		ConditionT& c = conditions.back();
+		if (name == "endif")
+		{
+			conditions.pop_back();
+			if (guard.state == GUARD_OPEN && conditions.size() == guard.depth)
+				guard.state = GUARD_CLOSED;
+			return;
+		}
+		if (c.hasElse)
+			fail(hash, "#" + name + " after #else");
+		if (name == "else")
+		{
+			c.hasElse = true;
+			c.isActive = c.isParentActive && !c.wasTaken;
+		}
+		else
+			c.isActive = c.isParentActive && !c.wasTaken && evaluate(hash, rest, n);
+		c.wasTaken = c.wasTaken || c.isActive;
+		return;
+	}
+	if (!isActive())
+		return;
+	if (name == "include")
+		include(file, hash, rest, n);
+	else if (name == "define")
+		define(hash, rest, n);
+	else if (name == "undef")
+	{
+		if (n == 0 || rest[0] != IDENTIFIER)
+			fail(hash, "expected macro name");
+		invalidate(rest[0].textId);
+		macros.erase(rest[0].textId);
+	}
+	else if (name == "pragma")
+	{
+		lock_guard<mutex> lock(filesLock);
+		if (n > 0 && rest[0].getText() == "once")
+			file.isOnce = true;
+	}
+	else if (name == "error")
+	{
+		size_t base = file.source->getBase(), begin = args[0].offset + args[0].length - base, end = hash.offset + hash.length - base;
+		string text;
+		for (const char* c = file.source->begin() + begin; c < file.source->begin() + end; c++)
+			if (*c != '\\' || c + 1 == file.source->begin() + end || c[1] != '\n')
+				text.push_back(*c == '\n' ? ' ' : *c);
+		size_t first = text.find_first_not_of(" \t\v"), last = text.find_last_not_of(" \t\v");
+		fail(hash, "#error" + (first == string::npos ? "" : " " + text.substr(first, last - first + 1)));
+	}
+	else
+		fail(hash, "unknown directive #" + name);
+}
+
+void Preprocessor::pushCondition(bool isTrue)
+{
+	ConditionT c = {isTrue, isActive(), isTrue, false};
+	conditions.push_back(c);
+}
+
+/* a file whose guard macro is defined (or that said #pragma once) is not even looked at again */
+void Preprocessor::include(SourceFileT& from, const Token& hash, const Token* args, size_t count)
+{
+	string name;
+	if (count > 0 && args[0] == STRING_CONST)
+	{
+		const string& text = args[0].getText();
+		name = text.substr(1, text.size() - 2);
+	}
+	else if (count > 0 && args[0] == OP_LESS)
+	{
+		size_t base = from.source->getBase(), begin = args[0].offset + 1 - base, end = hash.offset + hash.length - base;
+		const char* data = from.source->begin();
+		const char* close = static_cast<const char*>(memchr(data + begin, '>', end - begin));
+		if (close != NULL)
+			name.assign(data + begin, close);
+	}
+	if (name.empty())
+		fail(hash, "expected file name");
+	if (includeDepth >= MAX_INCLUDE_DEPTH)
+		fail(hash, "#include nested too deeply");
+	SourceFileT* file = findFile(from.dir, name);
+	if (file == NULL)
+		fail(hash, "cannot open include file " + name);
+	{
+		lock_guard<mutex> lock(filesLock);
+		if (file->isOnce || (file->guard != 0 && macros.count(file->guard) != 0))
+		{
+			++stats.guardSkips;
+			return;
+		}
+	}
+	call_once(file->lexFlag, lexInclude, file);
+	++includeDepth;
+	process(*file);
+	--includeDepth;
+}
+
+void Preprocessor::define(const Token& hash, const Token* args, size_t count)
+{
+	if (count == 0 || args[0] != IDENTIFIER)
+		fail(hash, "expected macro name");
+	if (count > 1 && args[1] == L_PARENTHESIS && args[1].offset == args[0].offset + args[0].length)
+		fail(hash, "function-like macros are not supported");
+	invalidate(args[0].textId);
+	MacroT& macro = macros[args[0].textId];
+	macro.body.assign(args + 1, args + count);
+	macro.isCached = false;
+}
+
+/* a cached expansion can only change when a name it looked at is defined or undefined */
+void Preprocessor::invalidate(unsigned int name)
+{
+	if (dependencies.count(name) == 0)
+		return;
+	for (map<unsigned int, MacroT>::iterator it = macros.begin(); it != macros.end(); ++it)
+		it->second.isCached = false;
+	dependencies.clear();
+}
+
+/*
+	object-like macros do not depend on the tokens around the use, so the
+	fully expanded body is kept and copied out with the use's location
+*/
+void Preprocessor::expand(MacroT& macro, const Token& use)
+{
+	++expansions;
+	if (macro.isCached)
+		++expansionHits;
+	else
+	{
+		macro.expansion.clear();
+		dependencies.insert(use.textId);
+		expanding.push_back(use.textId);
+		expandBody(macro.body, macro.expansion);
+		expanding.pop_back();
+		macro.isCached = true;
+	}
+	for (size_t i = 0; i < macro.expansion.size(); i++)
+	{
+		tokens.push_back(macro.expansion[i]);
+		tokens.back().offset = use.offset;
+		tokens.back().length = use.length;
+	}
+}
+
+void Preprocessor::expandBody(const vector<Token>& body, vector<Token>& out)
+{
+	for (size_t i = 0; i < body.size(); i++)
+	{
+		const Token& t = body[i];
+		if (t == IDENTIFIER)
+		{
+			dependencies.insert(t.textId);
+			map<unsigned int, MacroT>::iterator m = macros.find(t.textId);
+			if (m != macros.end() && find(expanding.begin(), expanding.end(), t.textId) == expanding.end())
+			{
+				expanding.push_back(t.textId);
+				expandBody(m->second.body, out);
+				expanding.pop_back();
+				continue;
+			}
+		}
+		out.push_back(t);
+	}
+}
+
+/* defined is resolved before the rest is expanded; identifiers left over count as 0 */
+bool Preprocessor::evaluate(const Token& hash, const Token* args, size_t count)
+{
+	vector<Token> e;
+	for (size_t i = 0; i < count; i++)
+	{
+		const Token& t = args[i];
+		if (t == IDENTIFIER && t.getText() == "defined")
+		{
+			bool hasParenthesis = i + 1 < count && args[i + 1] == L_PARENTHESIS;
+			size_t at = i + 1 + hasParenthesis;
+			if (at >= count || args[at] != IDENTIFIER || (hasParenthesis && (at + 1 >= count || args[at + 1] != R_PARENTHESIS)))
+				fail(hash, "expected macro name after defined");
+			Token value(INT_CONST);
+			value.val.iValue = macros.count(args[at].textId) != 0;
+			e.push_back(value);
+			i = at + hasParenthesis;
+			continue;
+		}
+		map<unsigned int, MacroT>::iterator m = t == IDENTIFIER ? macros.find(t.textId) : macros.end();
+		if (m == macros.end())
+		{
+			e.push_back(t);
+			continue;
+		}
+		expanding.push_back(t.textId);
+		expandBody(m->second.body, e);
+		expanding.pop_back();
+	}
+	e.push_back(Token(EOF_TOKEN));
+	size_t i = 0;
+	long long value = evalConditional(e, i, hash, true);
+	if (e[i] != EOF_TOKEN)
+		fail(hash, "unexpected token in #if");
+	return value != 0;
+}
@@ -0,0 +1,88 @@
+#ifndef PREPROCESSOR_H
+#define PREPROCESSOR_H
+#include "scanner.h"
+#include <set>
+
+typedef struct
+{
+	unsigned long includes, mappedFiles, lexedFiles, guardSkips, expansions, expansionHits;
+}PreprocessorStatsT;
+
+struct SourceFileT;
+
+/*
+	directives are handled on the token stream: the scanner returns '#' as
+	an OP_HASH token and a '#' that starts a line takes the rest of the line
+	with it. Include files are mapped and lexed once per process and shared
+	by every Preprocessor; macros and conditionals belong to one translation
+	unit
+*/
+class Preprocessor : public TokenStream
+{
+private :
+
+	typedef struct
+	{
+		vector<Token> body, expansion;
+		bool isCached;
+	}MacroT;
+
+	typedef struct
+	{
+		bool isActive, isParentActive, wasTaken, hasElse;
+	}ConditionT;
+
+	typedef enum
+	{
+		GUARD_UNKNOWN,
+		GUARD_OPEN,
+		GUARD_CLOSED,
+		GUARD_NONE,
+	}GuardStateT;
+
+	typedef struct
+	{
+		GuardStateT state;
+		unsigned int name;
+		size_t depth;
+	}GuardT;
+
+	Scanner& scanner;
+	string dir;
+	map<unsigned int, MacroT> macros;
+	set<unsigned int> dependencies;
+	vector<unsigned int> expanding;
+	vector<ConditionT> conditions;
+	vector<Token> tokens;
+	size_t tokenIndex;
+	ScannerException* error;
+	bool isDone;
+	int includeDepth;
+	unsigned long directives, expansions, expansionHits;
+
+	void run();
+	void process(SourceFileT& file);
+	void directive(SourceFileT& file, const Token& hash, const Token* args, size_t count, GuardT& guard);
+	void include(SourceFileT& from, const Token& hash, const Token* args, size_t count);
+	void define(const Token& hash, const Token* args, size_t count);
+	void invalidate(unsigned int name);
+	void expand(MacroT& macro, const Token& use);
+	void expandBody(const vector<Token>& body, vector<Token>& out);
+	bool evaluate(const Token& hash, const Token* args, size_t count);
+	void pushCondition(bool isTrue);
+	bool isActive() const {return conditions.empty() || conditions.back().isActive;}
+public :
+
+	Preprocessor(Scanner& _scanner, const string& filename);
+	~Preprocessor();
+	Token& next();
+	void tokenize(vector<Token>& out);
+	Source_buffer* getSource() const {return scanner.getSource();}
+	/* without directives the output is the scanner's tokens as they were lexed */
+	bool hasDirectives() const {return directives != 0;}
+};
+
+extern PreprocessorStatsT getPreprocessorStats();
+extern void clearIncludeCache();
+
+#endif
@@ -1,27 +1,22 @@
 ﻿#include "scanner.h"
 #include <stdlib.h>
-
-map<string, Token> operators, keywords, separators;
-
-const char* TOKEN_TYPE_NAMES[75] = 
-{
-#define TOKEN(name, text) #name,
-#include "tokenTypes.def"
-#undef TOKEN
-};
-
-const char* TOKEN_TEXT[75] =
-{
-#define TOKEN(name, text) text,
-#include "tokenTypes.def"
-#undef TOKEN
-}; 
+#include <string.h>
+#include <thread>
+#include <atomic>
+#include <limits.h>
+#include <math.h>
+#include <stdexcept>
 
 #define OP_END OP_COLON + 1 
+#define KW_BEGIN KW_BREAK
 #define KW_END KW_WHILE + 1
-#define SEP_END SEMICOLON + 1
 #define TOK_BEGIN L_BRACE 
 #define TOK_END KW_END
+#define PARALLEL_LEX_MIN (1 << 20)
+#ifndef MIN_LEX_CHUNK
+#define MIN_LEX_CHUNK (64 << 10)
+#endif
+#define MAX_FLOAT_EXPONENT 100000
 
 typedef enum
 {
@@ -31,36 +26,126 @@ typedef enum
 	IS_NOT_COMMENT,
 }CommentTypeT;
 
-static void initTables()
+/*
+	keywords are classified with a hash over (length, first char, last char)
+	that is collision free for the KW_* entries of tokenTypes.def, so a lookup
+	is one probe and one compare; building the table throws if a keyword
+	added there takes a slot that is already used, the hash has to change then
+*/
+#define KW_HASH_SIZE 64
+
+static unsigned char keywordHash[KW_HASH_SIZE];
+static size_t keywordMinLen = ~(size_t)0, keywordMaxLen = 0;
+
+static __inline unsigned int hashKeyword(const char* s, size_t len)
+{
+	return (len + (unsigned char)s[0] * 5 + (unsigned char)s[len - 1] * 15) & (KW_HASH_SIZE - 1);
+}
+
+static void putKeyword(TokenTypeT t)
+{
+	const char* text = TOKEN_TEXT[t];
+	size_t len = strlen(text);
+	unsigned int h = hashKeyword(text, len);
+	if (keywordHash[h] != UNDEFINED)
+		throw logic_error(string("keyword hash collision between ") + TOKEN_TEXT[keywordHash[h]] + " and " + text);
+	keywordHash[h] = t;
+	if (len < keywordMinLen)
+		keywordMinLen = len;
+	if (len > keywordMaxLen)
+		keywordMaxLen = len;
+}
+
+static TokenTypeT getKeyword(const char* s, size_t len)
+{
+	if (len < keywordMinLen || len > keywordMaxLen)
+		return IDENTIFIER;
+	unsigned char t = keywordHash[hashKeyword(s, len)];
+	if (t == UNDEFINED)
+		return IDENTIFIER;
+	const char* text = TOKEN_TEXT[t];
+	/* strncmp stops at the end of a keyword shorter than the identifier */
+	return strncmp(text, s, len) == 0 && text[len] == '\0' ? TokenTypeT(t) : IDENTIFIER;
+}
+
+/*
+	separators and operators are recognized by one DFA built from the trie of
+	their texts; the scan remembers the last accepting state, so the longest
+	match is found in a single forward pass
+*/
+#define OP_STATES 64
+
+static unsigned char opTransition[OP_STATES][256];
+static unsigned char opAccept[OP_STATES];
+static unsigned char opStates = 1;
+
+static void putOperator(TokenTypeT t)
+{
+	unsigned char state = 0;
+	for (const char* c = TOKEN_TEXT[t]; *c != '\0'; c++)
+	{
+		unsigned char& next = opTransition[state][(unsigned char)*c];
+		if (next == 0)
+			next = opStates++;
+		state = next;
+	}
+	opAccept[state] = t;
+}
+
+static once_flag tablesFlag;
+
+static void buildTables()
 {
 	for (int t = TOK_BEGIN; t < TOK_END + 1; t++)
 	{	
-		if (t < SEP_END)
-		{
-			separators[TOKEN_TEXT[t]] = Token((TokenTypeT)t, TOKEN_TYPE_NAMES[t], TOKEN_TEXT[t]);
-			continue;
-		}
 		if (t < OP_END)
 		{
-			operators[TOKEN_TEXT[t]] = Token((TokenTypeT)t, TOKEN_TYPE_NAMES[t], TOKEN_TEXT[t]);
+			putOperator((TokenTypeT)t);
 			continue;
 		}
-		if (t < KW_END)
-				keywords[TOKEN_TEXT[t]] = Token((TokenTypeT)t, TOKEN_TYPE_NAMES[t], TOKEN_TEXT[t]);
+		if (t >= KW_BEGIN && t < KW_END)
+			putKeyword((TokenTypeT)t);
 	}
 }
 
-Scanner::Scanner(FILE* stream) : line(1), col(0), colTokenBegin(0), lineTokenBegin(1), wasPrev(false) 
+/* the tables are shared by every scanner, so scanners started on several threads build them once */
+static void initTables()
+{
+	call_once(tablesFlag, buildTables);
+}
+
+Scanner::Scanner(FILE* stream) : pos(0), tokenBegin(0), ch(0), isOwner(true)
+{
+	source = new Source_buffer(stream);
+	data = source->begin();
+	size = source->size();
+	initTables();
+};
+
+Scanner::Scanner(Source_buffer* _source, size_t begin, size_t end) : source(_source), pos(begin), tokenBegin(begin), ch(0), isOwner(false)
 {
-	buf_stream = new Buffered_stream(stream, line, col);
+	data = source->begin();
+	size = end;
 	initTables();
 };
 
-Scanner::~Scanner() {delete buf_stream;};
+Scanner::~Scanner() {if (isOwner) delete source;};
 
-static CommentTypeT getCommentType(string tokenText)
+/* moves a scanner that does not own its buffer on to another text, e.g. the next version of a watched file */
+void Scanner::rebind(Source_buffer* _source, size_t begin, size_t end)
 {
-	return tokenText == "//" ? LINE : tokenText == "/*" ? BEGIN : tokenText == "*/" ? END : IS_NOT_COMMENT;
+	source = _source;
+	data = source->begin();
+	size = end;
+	pos = tokenBegin = begin;
+	ch = 0;
+}
+
+static CommentTypeT getCommentType(char first, char second)
+{
+	if (first == '/')
+		return second == '/' ? LINE : second == '*' ? BEGIN : IS_NOT_COMMENT;
+	return first == '*' && second == '/' ? END : IS_NOT_COMMENT;
 }
 
 static __inline bool isWhiteSpace(char ch)
@@ -108,6 +193,11 @@ static bool isDigitBase(char ch, int base)
 	return 0;
 }
 
+static __inline bool isIdentChar(char ch)
+{
+	return isalpha(ch) || ch == '_' || isdigit(ch);
+}
+
 extern string getTypeText(TokenTypeT type)
 {
 	return TOKEN_TEXT[type];
@@ -115,267 +205,296 @@ extern string getTypeText(TokenTypeT type)
 
 int Scanner::getLine() const
 {
+	int line, col;
+	source->locate(pos - 1, line, col);
 	return line;
 }
 
 int Scanner::getCol() const
 {
+	int line, col;
+	source->locate(pos - 1, line, col);
 	return col;
 }
 
-char Scanner::getChar(ReadT type = WITH_ADDITIONALBUF)
+void Scanner::exception(size_t offset, const string& error)
+{
+	int line, col;
+	source->locate(offset, line, col);
+	throw ScannerException(line, col, error);
+}
+
+char Scanner::charAt(size_t i) const
+{
+	return i < size ? data[i] : EOF;
+}
+
+char Scanner::peekChar() const
+{
+	return charAt(pos);
+}
+
+char Scanner::getChar()
+{
+	return ch = charAt(pos++);
+}
+
+void Scanner::seek(size_t offset)
 {
-	if (type == WITH_ADDITIONALBUF)
-		tryUseAdditionalBuf();
-	return ch = buf_stream->get();;
+	pos = tokenBegin = offset;
+	ch = 0;
+}
+
+void Scanner::skipTo(size_t i)
+{
+	if (i <= pos)
+		return;
+	pos = i;
+	ch = data[i - 1];
 }
 
 bool Scanner::trySkipComments()
 {
 	if (isEOF(ch))
 		return false;
-	tokenText.push_back(ch);
-	tokenText.push_back(buf_stream->get());
-	bool isComment = true;
-	switch (getCommentType(tokenText))
+	switch (getCommentType(ch, peekChar()))
 	{
-		case LINE : while (!isEOLN(ch) && !isEOF(ch)) getChar(WITHOUT_ADDITIONALBUF);break;
+		case LINE : 
+			{
+				const char* eoln = static_cast<const char*>(memchr(data + pos, '\n', size - pos));
+				skipTo(eoln == NULL ? size : eoln - data);
+				getChar();
+			}break;
 		case BEGIN : 
 			{
-				bool endfounded = false;
-				while (!isEOF(ch) && !endfounded)
+				getChar();
+				const char* end = findCommentEnd(data + pos, data + size);
+				if (end == data + size)
 				{
-					if (getChar(WITHOUT_ADDITIONALBUF) == '*')
-						if (!(endfounded = (!isEOF(ch) && (getChar(WITHOUT_ADDITIONALBUF) == '/'))))
-							buf_stream->back(1);
+					skipTo(size);
+					getChar();
+					exception(pos - 1, "expected */");
 				}
-				if (isEOF(ch))
-					throw ScannerException(line, col, "expected */");
-				getChar(WITHOUT_ADDITIONALBUF);
+				skipTo(end - data + 2);
+				getChar();
 			}break;
-		case END : throw ScannerException(line, col, "expected /*");
-		default : { buf_stream->back(1); isComment = false; };
+		case END : getChar(); exception(pos - 1, "expected /*");
+		default : return false;
 	}
-	tokenText.clear();
-	return isComment;
+	return true;
 }
 
 bool Scanner::trySkipWhiteSpaces()
 {
 	if (!isWhiteSpace(ch))
 		return false;
-	while (isWhiteSpace(ch))
-		getChar(WITHOUT_ADDITIONALBUF);
+	skipTo(findNonBlank(data + pos, data + size) - data);
+	getChar();
 	return !isEOF(ch);	
 }
 
-bool Scanner::isOperator()
-{
-	return operators.find(tokenText) != operators.end();
-}
-
 void Scanner::readOperator()
 {
 	if (state == TOKEN_IS_INIT)
 		return;
-	bool isRead = false;
-	while (isOperator() || (!isRead && ch == '|'))
+	unsigned char s = 0, next;
+	TokenTypeT t = UNDEFINED;
+	size_t i = tokenBegin, end = tokenBegin;
+	while (i < size && (next = opTransition[s][(unsigned char)data[i]]) != 0)
 	{
-		isRead = true;
-		tokenText.push_back(getChar(WITHOUT_ADDITIONALBUF));
-		if (isEOLN(ch) || !isOperator())
-			buf_stream->back(1);	
+		s = next;
+		++i;
+		if (opAccept[s] != UNDEFINED)
+		{
+			t = TokenTypeT(opAccept[s]);
+			end = i;
+		}
 	}
-	if (state = StateT(isRead))
-		currToken = operators[tokenText.substr(0, tokenText.size() - 1)];
-}
-
-bool Scanner::isSeparator()
-{
-	return separators.find(tokenText) != separators.end();
-}
-
-void Scanner::readSeparator()
-{
-	if (state == TOKEN_IS_INIT || !isSeparator())
+	if (t == UNDEFINED)
 		return;
-	currToken = separators.find(tokenText)->second;
+	skipTo(end);
+	currToken = Token(t);
 	state = TOKEN_IS_INIT;
 }
 
-void Scanner::readFloatPart()
+void Scanner::readFloatPart(size_t& i, char& c, DecimalT& decimal)
 {
-	if (ch == '.')
+	if (c == '.')
 	{
-		getChar();
-		while(isDigitBase(ch, 10))
-			getChar();
+		c = charAt(++i);
+		for (; isDigitBase(c, 10); c = charAt(++i))
+			pushDecimalDigit(decimal, c - '0', true);
 	}
-	if (ch == 'e' || ch == 'E')
+	if (c == 'e' || c == 'E')
 	{
-		getChar();
-		if (ch == '+' || ch == '-')
-			getChar();
-		int i = 0;
-		for (; isDigitBase(ch, 10); i++)
-			getChar();
-		if (i == 0)
-			throw ScannerException(lineTokenBegin, colTokenBegin, "invalid float constant");
+		c = charAt(++i);
+		bool isNegative = c == '-';
+		if (c == '+' || c == '-')
+			c = charAt(++i);
+		int digits = 0, power = 0;
+		for (; isDigitBase(c, 10); digits++)
+		{
+			if (power < MAX_FLOAT_EXPONENT)
+				power = power * 10 + c - '0';
+			c = charAt(++i);
+		}
+		if (digits == 0)
+			exception(tokenBegin, "invalid float constant");
+		decimal.exponent += isNegative ? -power : power;
 	}
-	if (ch == '.' || ch == 'e' || ch == 'E')
-		throw ScannerException(lineTokenBegin, colTokenBegin, "invalid float constant");
-	currToken = Token(DOUBLE_CONST, TOKEN_TYPE_NAMES[DOUBLE_CONST], tokenText);
+	if (c == '.' || c == 'e' || c == 'E')
+		exception(tokenBegin, "invalid float constant");
+	currToken.type = DOUBLE_CONST;
 }
 
+/*
+	one pass over the literal: the integer value is kept in 64 bits to catch
+	overflow, and the decimal digits are collected alongside in case the
+	literal turns out to be a float
+*/
 void Scanner::readNum()
 {
 	if (state == TOKEN_IS_INIT || !isdigit(ch))
 		return;
-	int base = 10, intValue = 0, digit = 0;
-	bool isHexOct = false, isFirstDigitNull = false;
-	for (; isDigitBase(ch, base) || isFirstDigitNull; digit++)
+	int base = 10, digit = 0;
+	unsigned long long intValue = 0;
+	bool isHexOct = false, isFirstDigitNull = false, isOverflow = false;
+	DecimalT decimal = {0, 0, 0, false};
+	size_t i = tokenBegin;
+	char c = ch;
+	for (; isDigitBase(c, base) || isFirstDigitNull; digit++)
 	{
 		if (digit == 0)
-			isHexOct = isFirstDigitNull = (ch == '0');
-		intValue = intValue * base + getDigitValue(ch);
-		getChar();
+			isHexOct = isFirstDigitNull = (c == '0');
+		int value = getDigitValue(c);
+		if (base != 16)
+			pushDecimalDigit(decimal, value, false);
+		if (!isOverflow)
+		{
+			intValue = intValue * base + value;
+			isOverflow = intValue > UINT_MAX;
+		}
+		c = charAt(++i);
 		if (isFirstDigitNull)
 		{
-			base = (ch == 'x' || ch == 'X') ? 16 : 8;
-			if (ch == '.')
+			base = (c == 'x' || c == 'X') ? 16 : 8;
+			if (c == '.')
 				base = 10;
 			isFirstDigitNull = false;
 		}
-		if (base == 8 && isdigit(ch) && !isOct(ch))
+		if (base == 8 && isdigit(c) && !isOct(c))
 			base = 10;
 		if (digit == 0 && base == 16)
-			getChar(WITHOUT_ADDITIONALBUF);
+			c = charAt(++i);
 	}
 	if (isHexOct)
 	{
-		if (base == 16 && (digit == 1 || ch == '.'))
-			throw ScannerException(lineTokenBegin, colTokenBegin, "invalid hex constant");
-		if (base == 10 && ch != '.' && ch != 'e' && ch != 'E')
-			throw ScannerException(lineTokenBegin, colTokenBegin, "invalid oct constant");
+		if (base == 16 && (digit == 1 || c == '.'))
+			exception(tokenBegin, "invalid hex constant");
+		if (base == 10 && c != '.' && c != 'e' && c != 'E')
+			exception(tokenBegin, "invalid oct constant");
 	}
-	currToken = Token(INT_CONST, TOKEN_TYPE_NAMES[INT_CONST], tokenText);
-	currToken.val.iValue = intValue;
-	if (base == 10 && ch == '.' || ch == 'e' || ch == 'E')
-		readFloatPart();
-	initTokenText();
-
-	//if (currToken.type != INT_CONST)
-		currToken.val.fValue = atof(tokenText.c_str());
-	currToken.text = tokenText;
-	state = TOKEN_IS_INIT;
-}
-
-void Scanner::tryUseAdditionalBuf()
-{
-	if (tokenBegin < 0)
+	currToken = Token(INT_CONST);
+	if ((base == 10 && c == '.') || c == 'e' || c == 'E')
+		readFloatPart(i, c, decimal);
+	skipTo(i);
+	currToken.setText(data + tokenBegin, pos - tokenBegin);
+	if (currToken.type == INT_CONST)
 	{
-		additional_buf.push(tokenText[0]);
-		tokenBegin = 0;
+		if (isOverflow || (!isHexOct && intValue > INT_MAX))
+			exception(tokenBegin, "integer constant is too large");
+		currToken.val.iValue = (int)intValue;
 	}
-	if (!buf_stream->hasNext())
+	else
 	{
-		buf_stream->fillQueueFrom(additional_buf, tokenBegin);
-		tokenBegin = 0;
+		double value;
+		if (!decimalToDouble(decimal, value))
+			value = strtod(currToken.getText().c_str(), NULL);
+		if (value == HUGE_VAL)
+			exception(tokenBegin, "float constant is too large");
+		currToken.val.fValue = value;
 	}
+	state = TOKEN_IS_INIT;
 }
 
 void Scanner::initTokenText()
 {
-	tokenText.clear();
+	tokenText.assign(data + tokenBegin, pos - tokenBegin);
+}
 
-	int tokenEnd = buf_stream->getpos() < 0 ? 0 : buf_stream->getpos(), valSize = additional_buf.size() + tokenEnd - tokenBegin;
-	if (valSize >= tokenText.max_size())
-		throw ScannerException(lineTokenBegin, colTokenBegin, "too long name");
-		
-	while (!additional_buf.empty())
+static bool unescape(char c, char& escaped)
+{
+	switch(c)
 	{
-		tokenText.push_back(additional_buf.front());
-		additional_buf.pop();
+		case '\'': escaped = '\''; break;
+		case '\"': escaped = '\"'; break;
+		case '\\': escaped = '\\'; break;
+		case '?': escaped = '\?'; break;
+		case 'a': escaped = '\a'; break;
+		case 'b': escaped = '\b'; break;
+		case 'f': escaped = '\f'; break;
+		case 'n': escaped = '\n'; break;
+		case 'r': escaped = '\r'; break;
+		case 't': escaped = '\t'; break;
+		case 'v': escaped = '\v'; break;
+		default : return false;
 	}
-	buf_stream->back(tokenEnd - tokenBegin + 1);
-	
-	for(int i = tokenBegin; i < tokenEnd; i++)
-		tokenText.push_back(buf_stream->get());
+	return true;
 }
 
 void Scanner::processEscapeSequences()
 {
-	if (ch != '\\')
+	char escaped;
+	if (ch != '\\' || !unescape(peekChar(), escaped))
 		return;
-	char next = buf_stream->get();
-	switch(next)
-	{
-        case '\'': ch = '\''; break;
-        case '\"': ch = '\"'; break;
-        case '\\': ch = '\\'; break;
-        case '?': ch = '\?'; break;
-        case 'a': ch = '\a'; break;
-        case 'b': ch = '\b'; break;
-        case 'f': ch = '\f'; break;
-        case 'n': ch = '\n'; break;
-        case 'r': ch = '\r'; break;
-        case 't': ch = '\t'; break;
-        case 'v': ch = '\v'; break;
-		default : buf_stream->back(1);
-	}
+	getChar();
+	ch = escaped;
 }
 
 void Scanner::readIdentAndKeyword()
 {
 	if (state == TOKEN_IS_INIT || (ch != '_' && !isalpha(ch)))
 		return;
-	while (isalpha(ch) || ch == '_' || isdigit(ch))
+	while (isIdentChar(peekChar()))
 		getChar();
-	initTokenText();
-	currToken = keywords.find(tokenText) != keywords.end() ? keywords[tokenText] : Token(IDENTIFIER, TOKEN_TYPE_NAMES[IDENTIFIER], tokenText);
+	TokenTypeT t = getKeyword(data + tokenBegin, pos - tokenBegin);
+	if (t != IDENTIFIER)
+		currToken = Token(t);
+	else
+		currToken = Token(IDENTIFIER, data + tokenBegin, pos - tokenBegin);
 	state = TOKEN_IS_INIT;
 }
 
+/*
+	escapes are decoded while looking for the closing quote; the quote after
+	a backslash both ends the literal and stands for itself, and unknown
+	escapes are dropped
+*/
 void Scanner::readStr()
 {
 	if (state == TOKEN_IS_INIT || ch != '"')
 		return;
-	do
-		getChar();
-	while (ch != '"' && !isEOF(ch) && !isEOLN(ch));
-
-	if (isEOF(ch) || isEOLN(ch))
-		throw ScannerException(line, col, "expected end of the string");
-		
-	initTokenText();
-	tokenText.push_back(ch = buf_stream->get());
-	string tmp;
-	int i = 0;
-	for (; i < tokenText.size(); i++)
+	tokenText.assign(1, '"');
+	for (getChar(); ch != '"' && !isEOF(ch) && !isEOLN(ch); getChar())
 	{
-		if (tokenText[i] != '\\')
+		char escaped;
+		if (ch != '\\')
 		{
-			tmp.push_back(tokenText[i]);
+			tokenText.push_back(ch);
 			continue;
 		}
-		char& next = tokenText[++i];
-		switch(next)
-		{
-			case '\'': tmp.push_back('\''); break;
-			case '\"': tmp.push_back('\"'); break;
-			case '\\': tmp.push_back('\\'); break;
-			case '?': tmp.push_back('\?'); break;
-			case 'a': tmp.push_back('\a'); break;
-			case 'b': tmp.push_back('\b'); break;
-			case 'f': tmp.push_back('\f'); break;
-			case 'n': tmp.push_back('\n'); break;
-			case 'r': tmp.push_back('\r'); break;
-			case 't': tmp.push_back('\t'); break;
-			case 'v': tmp.push_back('\v'); break;
-		}
+		getChar();
+		if (ch == '"' || isEOF(ch) || isEOLN(ch))
+			break;
+		if (unescape(ch, escaped))
+			tokenText.push_back(escaped);
 	}
-	currToken = Token(STRING_CONST, TOKEN_TYPE_NAMES[STRING_CONST], tokenText);
-	currToken.val.strValue = tmp;
+
+	if (isEOF(ch) || isEOLN(ch))
+		exception(pos - 1, "expected end of the string");
+	tokenText.push_back('"');
+	currToken = Token(STRING_CONST, data + tokenBegin, pos - tokenBegin);
+	currToken.setStrValue(tokenText);
 	state = TOKEN_IS_INIT;
 }
 
@@ -383,45 +502,36 @@ void Scanner::readChar()
 {
 	if (state == TOKEN_IS_INIT || ch != '\'')
 		return;
-	getChar(WITHOUT_ADDITIONALBUF);
+	getChar();
 	while (ch != '\'' && !isEOF(ch) && !isEOLN(ch))
 	{
 		processEscapeSequences();
 		tokenText.push_back(ch);
-		getChar(WITHOUT_ADDITIONALBUF);
+		getChar();
 	}
 	
 	if (isEOF(ch) || isEOLN(ch))
-		throw ScannerException(line, col, "invalid char const");
+		exception(pos - 1, "invalid char const");
 	tokenText.push_back(ch);
-	currToken = Token(CHAR_CONST, TOKEN_TYPE_NAMES[CHAR_CONST], tokenText);
+	currToken = Token(CHAR_CONST, tokenText);
 	if (tokenText.length() == 2 ||  tokenText.length() > 3)
-		throw ScannerException(line, col, "improper char's length");
-	currToken.val.strValue = tokenText.substr(1, tokenText.size() - 2); 
+		exception(pos - 1, "improper char's length");
+	currToken.setStrValue(tokenText.substr(1, tokenText.size() - 2)); 
 	state = TOKEN_IS_INIT;
 }
 
 Token& Scanner::next()
 {
-	if (wasPrev)
-	{
-		wasPrev = false;
-		return currToken;
-	}
-	prevToken = currToken;
 	tokenText.clear();
-	getChar(WITHOUT_ADDITIONALBUF);
+	getChar();
 	state = TOKEN_IS_NOT_INIT;
 
 	while (trySkipComments() || trySkipWhiteSpaces());
 	
 	tokenText.push_back(ch);
-	lineTokenBegin = line;
-	colTokenBegin = col;
-	tokenBegin = buf_stream->getpos();
+	tokenBegin = pos - 1;
 
 	readOperator();
-	readSeparator();
 	readStr();
 	readNum();
 	readIdentAndKeyword();
@@ -430,14 +540,15 @@ Token& Scanner::next()
 	if (state == TOKEN_IS_NOT_INIT && isEOF(ch))
 	{
 		state = TOKEN_IS_INIT;
-		currToken = Token(EOF_TOKEN, TOKEN_TYPE_NAMES[EOF_TOKEN], TOKEN_TEXT[EOF_TOKEN]);
+		currToken = Token(EOF_TOKEN);
+		tokenBegin = pos = size;
 	}
 
-	currToken.line = lineTokenBegin;
-	currToken.col = colTokenBegin;
+	currToken.offset = tokenBegin;
+	currToken.length = pos - tokenBegin;
 
 	if (state == TOKEN_IS_NOT_INIT)
-		throw ScannerException(line, col, "undefined");
+		exception(pos - 1, "undefined");
 	return currToken;
 }
 
@@ -446,8 +557,138 @@ Token& Scanner::get()
 	return currToken;
 }
 
-Token& Scanner::prev()
+static __inline bool isEscapeChar(char ch)
+{
+	return strchr("'\"\\?abfnrtv", ch) != NULL && ch != '\0';
+}
+
+/*
+	cuts [begin, end) after newlines that the scanner can only meet between
+	tokens, i.e. outside block comments, strings and char constants; a chunk
+	is closed at the first such newline past chunkSize bytes
+*/
+static void findChunkBoundaries(const char* data, size_t begin, size_t end, size_t chunkSize, vector<size_t>& bounds)
+{
+	size_t i = begin, target = begin + chunkSize;
+	bounds.push_back(begin);
+	while (i < end && target < end)
+	{
+		char c = data[i];
+		if (c == '\n')
+		{
+			if (++i >= target && i < end)
+			{
+				bounds.push_back(i);
+				target = i + chunkSize;
+			}
+			continue;
+		}
+		if (c == '/' && i + 1 < end && data[i + 1] == '/')
+		{
+			const char* eoln = static_cast<const char*>(memchr(data + i, '\n', end - i));
+			i = eoln == NULL ? end : eoln - data;
+			continue;
+		}
+		if (c == '/' && i + 1 < end && data[i + 1] == '*')
+		{
+			const char* close = findCommentEnd(data + i + 2, data + end);
+			i = close == data + end ? end : close - data + 2;
+			continue;
+		}
+		if (c == '"' || c == '\'')
+		{
+			for (++i; i < end && data[i] != c && data[i] != '\n'; i++)
+				if (c == '\'' && data[i] == '\\' && i + 1 < end && isEscapeChar(data[i + 1]))
+					++i;
+			if (i < end && data[i] == c)
+				++i;
+			continue;
+		}
+		++i;
+	}
+	bounds.push_back(end);
+}
+
+typedef struct
+{
+	Source_buffer* source;
+	const vector<size_t>* bounds;
+	vector<vector<Token> >* parts;
+	vector<ScannerException*>* errors;
+	atomic<size_t>* nextChunk;
+}LexJobT;
+
+static void lexChunks(LexJobT* job)
+{
+	size_t i;
+	while ((i = (*job->nextChunk)++) < job->parts->size())
+	{
+		Scanner scanner(job->source, (*job->bounds)[i], (*job->bounds)[i + 1]);
+		try
+		{
+			scanner.tokenize((*job->parts)[i], 1);
+		}
+		catch (ScannerException &error)
+		{
+			(*job->errors)[i] = new ScannerException(error);
+		}
+	}
+}
+
+void Scanner::tokenize(vector<Token>& tokens)
 {
-	wasPrev = true;
-	return prevToken;
+	unsigned int threads = size - pos >= PARALLEL_LEX_MIN ? thread::hardware_concurrency() : 1;
+	tokenize(tokens, threads == 0 ? 1 : threads);
+}
+
+/*
+	with several threads the rest of the input is split by
+	findChunkBoundaries and every chunk is lexed by its own Scanner; the
+	chunks are glued back in order, dropping their EOF tokens, and the
+	first chunk error is rethrown after the tokens before it, which is
+	exactly what the serial loop produces
+*/
+void Scanner::tokenize(vector<Token>& tokens, unsigned int threads)
+{
+	vector<size_t> bounds;
+	if (threads > 1)
+		findChunkBoundaries(data, pos, size, max((size - pos) / (threads * 4), (size_t)MIN_LEX_CHUNK), bounds);
+	if (bounds.size() < 3)
+	{
+		do
+			tokens.push_back(Scanner::next());
+		while (tokens.back() != EOF_TOKEN);
+		return;
+	}
+
+	size_t chunks = bounds.size() - 1;
+	vector<vector<Token> > parts(chunks);
+	vector<ScannerException*> errors(chunks, (ScannerException*)NULL);
+	atomic<size_t> nextChunk(0);
+	LexJobT job = {source, &bounds, &parts, &errors, &nextChunk};
+	vector<thread> pool;
+	for (size_t t = 0; t < threads && t < chunks; t++)
+		pool.push_back(thread(lexChunks, &job));
+	for (size_t t = 0; t < pool.size(); t++)
+		pool[t].join();
+
+	size_t count = 0;
+	for (size_t i = 0; i < chunks; i++)
+		count += parts[i].size();
+	tokens.reserve(tokens.size() + count);
+	for (size_t i = 0; i < chunks; i++)
+	{
+		vector<Token>& part = parts[i];
+		bool isLast = i == chunks - 1 || errors[i] != NULL;
+		tokens.insert(tokens.end(), part.begin(), isLast ? part.end() : part.end() - 1);
+		if (errors[i] != NULL)
+		{
+			ScannerException error(*errors[i]);
+			for (size_t j = 0; j < chunks; j++)
+				delete errors[j];
+			throw error;
+		}
+	}
+	pos = size;
+	currToken = tokens.back();
 }
\ No newline at end of file
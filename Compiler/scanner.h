@@ -4,10 +4,21 @@
 #include <map>
 #include "buffer.h"
 #include "exceptions.h"
+#include "number.h"
 
 extern string getTypeText(TokenTypeT type);
 
-class Scanner
+/* what the parser reads tokens from: the scanner itself or the preprocessor in front of it */
+class TokenStream
+{
+public:
+	virtual ~TokenStream(){}
+	virtual Token& next() = 0;
+	virtual void tokenize(vector<Token>& tokens) = 0;
+	virtual Source_buffer* getSource() const = 0;
+};
+
+class Scanner : public TokenStream
 {
 private:
 
@@ -17,45 +28,45 @@ private:
 		TOKEN_IS_INIT,
 	};
 
-	enum ReadT
-	{
-		WITHOUT_ADDITIONALBUF,
-		WITH_ADDITIONALBUF,
-	};
-
-	queue<char> additional_buf;
-	Buffered_stream *buf_stream;
+	Source_buffer *source;
+	const char *data;
+	size_t size, pos, tokenBegin;
 	string tokenText;
 	char ch;
-	int line, col, colTokenBegin, lineTokenBegin, tokenBegin;
 	StateT state; 
-	bool wasPrev;
+	bool isOwner;
 	
 	void readIdentAndKeyword();
 	void readChar();
 	void readStr();
 	void readOperator();
-	void readFloatPart();
+	void readFloatPart(size_t& i, char& c, DecimalT& decimal);
 	void readIntPart();
 	void readNum();
-	void readSeparator();
-	bool isOperator();
-	bool isSeparator();
 	bool trySkipComments();
 	bool trySkipWhiteSpaces();
 	void initTokenText();
-	void tryUseAdditionalBuf();
 	void processEscapeSequences();
 
-	char getChar(ReadT type);
+	char getChar();
+	char peekChar() const;
+	char charAt(size_t i) const;
+	void skipTo(size_t i);
+	void exception(size_t offset, const string& error);
 public:
 	Scanner(FILE* stream);
+	Scanner(Source_buffer* _source, size_t begin, size_t end);
 	Scanner(Scanner &scan);
 	~Scanner();
-	Token currToken, prevToken;
+	void rebind(Source_buffer* _source, size_t begin, size_t end);
+	Token currToken;
 	Token& get();
 	Token& next();
-	Token& prev();
+	void tokenize(vector<Token>& tokens);
+	void tokenize(vector<Token>& tokens, unsigned int threads);
+	Source_buffer* getSource() const {return source;}
+	size_t getOffset() const {return pos;}
+	void seek(size_t offset);
 	int getLine() const;
 	int getCol() const;
 };
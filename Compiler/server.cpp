@@ -0,0 +1,311 @@
+#include "server.h"
+#include "preprocessor.h"
+#include "intern.h"
+#include <string.h>
+#include <limits.h>
+#include <stdexcept>
+#include <system_error>
+#ifndef _WIN32
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#define MAX_PAYLOAD (64 << 20)
+#define RECLAIM_TEXTS (1 << 16)
+
+#ifndef _WIN32
+
+struct ConnectionT
+{
+	int fd;
+	mutex lock;
+	condition_variable isDone;
+	size_t pending;
+	bool isOpen;
+};
+
+static bool readAll(int fd, char* p, size_t size)
+{
+	while (size > 0)
+	{
+		ssize_t count = read(fd, p, size);
+		if (count <= 0)
+			return false;
+		p += count;
+		size -= count;
+	}
+	return true;
+}
+
+static bool writeAll(int fd, const char* p, size_t size)
+{
+	while (size > 0)
+	{
+		ssize_t count = write(fd, p, size);
+		if (count <= 0)
+			return false;
+		p += count;
+		size -= count;
+	}
+	return true;
+}
+
+/* headers are short, so they are read a byte at a time to leave the payload that follows in the socket */
+static bool readLine(int fd, string& line)
+{
+	char ch;
+	line.clear();
+	while (readAll(fd, &ch, 1))
+	{
+		if (ch == '\n')
+			return true;
+		line += ch;
+	}
+	return false;
+}
+
+/* a size is taken from the peer, so one past the limit ends the connection instead of the allocation failing */
+static bool readString(int fd, string& s, size_t size)
+{
+	if (size > MAX_PAYLOAD)
+		return false;
+	s.resize(size);
+	return size == 0 || readAll(fd, &s[0], size);
+}
+
+static bool socketAddress(const string& path, sockaddr_un& address)
+{
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path))
+		return false;
+	strcpy(address.sun_path, path.c_str());
+	return true;
+}
+
+CompileServer::CompileServer(const string& path) : socketPath(path), listener(-1)
+{
+	sockaddr_un address;
+	if (!socketAddress(path, address))
+		throw runtime_error("socket path is too long");
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0)
+		throw runtime_error("cannot create socket");
+	unlink(path.c_str());
+	if (bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+		throw runtime_error("cannot listen on " + path);
+	signal(SIGPIPE, SIG_IGN);
+	internBase = internMark();
+	running = 0;
+	isReclaiming = false;
+	unsigned int count = max(1u, thread::hardware_concurrency());
+	for (unsigned int i = 0; i < count; i++)
+		workers.push_back(thread(&CompileServer::work, this));
+}
+
+CompileServer::~CompileServer()
+{
+	close(listener);
+	unlink(socketPath.c_str());
+}
+
+/* runs until the process is killed; every connection gets a thread of its own that reads its batch */
+void CompileServer::run()
+{
+	for (;;)
+	{
+		int fd = accept(listener, NULL, NULL);
+		if (fd < 0)
+			continue;
+		try
+		{
+			thread(&CompileServer::serve, this, fd).detach();
+		}
+		catch (system_error&)
+		{
+			close(fd);
+		}
+	}
+}
+
+void CompileServer::serve(int fd)
+{
+	ConnectionT* connection = new ConnectionT();
+	connection->fd = fd;
+	connection->pending = 0;
+	connection->isOpen = true;
+	string header;
+	for (size_t index = 0; readLine(fd, header) && !header.empty(); index++)
+	{
+		char key[32], source[8];
+		size_t nameSize, textSize;
+		JobT job;
+		if (sscanf(header.c_str(), "%31s %7s %zu %zu", key, source, &nameSize, &textSize) != 4)
+			break;
+		job.connection = connection;
+		job.index = index;
+		job.key = key;
+		job.isPath = strcmp(source, "path") == 0;
+		if (!readString(fd, job.name, nameSize) || !readString(fd, job.text, textSize))
+			break;
+		{
+			lock_guard<mutex> guard(connection->lock);
+			++connection->pending;
+		}
+		lock_guard<mutex> guard(jobsLock);
+		jobs.push_back(job);
+		hasJobs.notify_one();
+	}
+	unique_lock<mutex> guard(connection->lock);
+	while (connection->pending > 0)
+		connection->isDone.wait(guard);
+	guard.unlock();
+	close(fd);
+	delete connection;
+}
+
+/* the status of the result: ok, error, or missing when the source file cannot be opened */
+const char* CompileServer::compile(const JobT& job, string& output)
+{
+	if (job.key.size() < 2 || job.key[0] != '-' || job.key[1] != 'g')
+	{
+		output = "There is not such command\n";
+		return "error";
+	}
+	Compilation* compilation = NULL;
+	if (!job.isPath)
+		compilation = new Compilation(job.text, job.name);
+	else if (FILE* file = fopen(job.name.c_str(), "r"))
+	{
+		compilation = new Compilation(file, job.name);
+		fclose(file);
+	}
+	if (compilation == NULL)
+		return "missing";
+	compilation->setFlags(job.key);
+	bool isCompiled = compilation->compile();
+	output = compilation->getOutput();
+	delete compilation;
+	return isCompiled ? "ok" : "error";
+}
+
+/*
+	the workers stay up between batches, so a request only pays for its own
+	compilation. Once the compilations have interned RECLAIM_TEXTS new
+	spellings no job is started, and the last worker to finish drops the
+	include cache and releases the pool back to what it held at start
+*/
+void CompileServer::work()
+{
+	for (;;)
+	{
+		unique_lock<mutex> guard(jobsLock);
+		while (jobs.empty() || isReclaiming)
+			hasJobs.wait(guard);
+		JobT job = jobs.front();
+		jobs.pop_front();
+		++running;
+		guard.unlock();
+
+		string output;
+		const char* status;
+		try
+		{
+			status = compile(job, output);
+		}
+		catch (exception& error)
+		{
+			output = string("Internal Error: ") + error.what() + "\n";
+			status = "error";
+		}
+		char header[64];
+		int size = sprintf(header, "%zu %s %zu\n", job.index, status, output.size());
+		ConnectionT* connection = job.connection;
+		{
+			lock_guard<mutex> lock(connection->lock);
+			if (connection->isOpen)
+				connection->isOpen = writeAll(connection->fd, header, size) && writeAll(connection->fd, output.data(), output.size());
+			if (--connection->pending == 0)
+				connection->isDone.notify_one();
+		}
+
+		guard.lock();
+		--running;
+		isReclaiming = isReclaiming || internMark() - internBase > RECLAIM_TEXTS;
+		if (isReclaiming && running == 0)
+		{
+			clearIncludeCache();
+			internRelease(internBase);
+			isReclaiming = false;
+			hasJobs.notify_all();
+		}
+	}
+}
+
+bool CompileClient::run(const string& key, const vector<string>& files)
+{
+	sockaddr_un address;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return false;
+	if (!socketAddress(socketPath, address) || connect(fd, (sockaddr*)&address, sizeof(address)) != 0)
+	{
+		close(fd);
+		return false;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	string batch;
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		char path[PATH_MAX], header[64];
+		string name = realpath(files[i].c_str(), path) != NULL ? path : files[i];
+		sprintf(header, " path %zu 0\n", name.size());
+		batch += key + header + name;
+	}
+	batch += "\n";
+	bool isSent = writeAll(fd, batch.data(), batch.size());
+	string header, output;
+	size_t done = 0;
+	while (isSent && done < files.size() && readLine(fd, header))
+	{
+		size_t index, size;
+		char status[8];
+		if (sscanf(header.c_str(), "%zu %7s %zu", &index, status, &size) != 3 || index >= files.size() || !readString(fd, output, size))
+			break;
+		if (strcmp(status, "missing") == 0)
+			fprintf(stderr, "Cannot open file");
+		else
+		{
+			ofstream out(Compilation::outputName(files[index]).c_str());
+			out << output;
+		}
+		++done;
+	}
+	close(fd);
+	if (done < files.size())
+		fprintf(stderr, "compile server closed the connection\n");
+	return true;
+}
+#else
+
+/* there are no unix domain sockets to serve on: --serve fails, and a client finds no server and compiles the files itself */
+CompileServer::CompileServer(const string& path) : socketPath(path), listener(-1)
+{
+	throw runtime_error("--serve is not supported on Windows");
+}
+
+CompileServer::~CompileServer()
+{
+}
+
+void CompileServer::run()
+{
+}
+
+bool CompileClient::run(const string& key, const vector<string>& files)
+{
+	return false;
+}
+#endif
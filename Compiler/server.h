@@ -0,0 +1,64 @@
+#ifndef SERVER_H
+#define SERVER_H
+#include "compilation.h"
+#include <thread>
+#include <condition_variable>
+#include <deque>
+
+#define DEFAULT_SOCKET "/tmp/compiler.sock"
+
+/*
+	a client sends a batch of compile requests, each a header line
+	"<key> path|text <name length> <text length>" followed by the name and
+	the text, and ends it with an empty line; a path request is read from
+	the name by the server. Every result comes back as soon as it is done,
+	as "<index> ok|error|missing <length>" followed by the output the
+	command line would have written to <name>.asm
+*/
+struct ConnectionT;
+
+class CompileServer
+{
+private :
+
+	typedef struct
+	{
+		ConnectionT* connection;
+		size_t index;
+		string key, name, text;
+		bool isPath;
+	}JobT;
+
+	string socketPath;
+	int listener;
+	deque<JobT> jobs;
+	mutex jobsLock;
+	condition_variable hasJobs;
+	vector<thread> workers;
+	unsigned int internBase;
+	size_t running;
+	bool isReclaiming;
+
+	void work();
+	void serve(int fd);
+	static const char* compile(const JobT& job, string& output);
+public :
+
+	CompileServer(const string& path);
+	~CompileServer();
+	void run();
+};
+
+/* sends every file of one command line in a single batch and writes each result where the command line would */
+class CompileClient
+{
+private :
+
+	string socketPath;
+public :
+
+	CompileClient(const string& path) : socketPath(path){}
+	bool run(const string& key, const vector<string>& files);
+};
+
+#endif
@@ -1,6 +1,8 @@
 #include "symTable.h"
 #include "codeGen.h"
-#include "node.h"
+#include "flatTree.h"
+#include <algorithm>
+#include <stdexcept>
 
 #define EBP(offset) (offset + "[ebp]")
 #define RET_LABEL(funcName) (funcName + "RetLabel")
@@ -22,118 +24,454 @@ const string TypeText[11] =
 	"undefined",
 };
 
-SymType* _void = new SymTypeVoid();
-SymType* _float = new SymTypeFloat();
-SymType* _int = new SymTypeInteger();
-SymType* _double = new SymTypeDouble();
+/*
+	the builtins are shared by every compilation instead of belonging to
+	one: they are complete before main starts and nothing writes to them
+	afterwards, types derived from them are kept by each arena
+*/
+SymType* const _void = new SymTypeVoid();
+SymType* const _float = new SymTypeFloat();
+SymType* const _int = new SymTypeInteger();
+SymType* const _double = new SymTypeDouble();
 
-SymVar* _printf = new SymVarGlobal(Token(IDENTIFIER, "printf", "printf"), _int, new SyntaxNode());
-SymVar* _scanf = new SymVarGlobal(Token(IDENTIFIER, "scanf", "scanf"), _int, new SyntaxNode());
+static SymVar* builtinFunction(const char* name)
+{
+	SymVar* var = new SymVarGlobal(Token(IDENTIFIER, name), _int, new SyntaxNode());
+	var->assignType(new SymTypeFunc(_int, vector<Symbol*>()), false);
+	var->setAsmName("_imp__" + string(name));
+	return var;
+}
+
+SymVar* const _printf = builtinFunction("printf");
+SymVar* const _scanf = builtinFunction("scanf");
 
-SymbolTable::SymbolTable(){index = 0;}
+SymbolTable::SymbolTable(){stamp = 0; isVersioned = false; place = LAST_PLACE; isOrdered = false;}
 
-typedef list<SymbolTable*>::iterator iter;
+/*
+	names are interned ids, so a table is an open addressing hash of ids
+	with linear probing; a slot holds the id and the position of its
+	symbol in declaration order plus one, 0 for a free slot. Only an
+	ordered table ever removes a name, by building the slots again, and
+	they are only allocated with the first symbol
+*/
+#define MIN_SLOTS 8
+
+static __inline size_t hashName(unsigned int nameId, size_t mask)
+{
+	unsigned int h = nameId * 2654435769u;
+	return (h ^ h >> 15) & mask;
+}
+
+size_t SymbolTable::slotOf(unsigned int nameId) const
+{
+	size_t mask = slots.size() - 1;
+	size_t i = hashName(nameId, mask);
+	while (slots[i].index != 0 && slots[i].nameId != nameId)
+		i = (i + 1) & mask;
+	return i;
+}
 
-void SymbolTable::putSymbol(Symbol *sym)
+void SymbolTable::grow()
 {
-	const string& name = sym->getName();
-	Symbol* s = table[name];
+	vector<SlotT> old(max(slots.size() * 2, (size_t)MIN_SLOTS));
+	old.swap(slots);
+	for (size_t i = 0; i < old.size(); i++)
+		if (old[i].index != 0)
+			slots[slotOf(old[i].nameId)] = old[i];
+}
+
+/* the symbol the name is bound to afterwards: sym, or the one it is a redeclaration of */
+Symbol* SymbolTable::putSymbol(Symbol *sym)
+{
+	if (isOrdered)
+		return putOrdered(sym);
+	unsigned int name = sym->getNameId();
+	if ((symbols.size() + 1) * 4 > slots.size() * 3)
+		grow();
+	SlotT& slot = slots[slotOf(name)];
+	Symbol* s = slot.index == 0 ? NULL : symbols[slot.index - 1];
 	if (s != NULL && !sym->equal(s) || s != NULL && s->isParam())
 		throw ParserException(sym->getLine(), sym->getCol(), "redefinition, different basic types");
 	if (s == NULL || !s->isInit() && sym->isInit())
 	{
-		table[name] = sym;
 		if (s == NULL)
-			orderList.push_back(name);
+		{
+			symbols.push_back(sym);
+			slot.nameId = name;
+			slot.index = symbols.size();
+		}
+		else
+			symbols[slot.index - 1] = sym;
+		if (isVersioned)
+		{
+			vector<VersionT>& history = versions[name];
+			VersionT before = {0, s}, after = {++stamp, sym};
+			if (history.empty() && s != NULL)
+				history.push_back(before);
+			history.push_back(after);
+		}
+		return sym;
+	}
+	return s;
+}
+
+/*
+	a versioned table remembers which symbol each name had after every
+	change, so readers can see it as it was at an earlier stamp; names
+	put before versioning started are visible at every stamp
+*/
+void SymbolTable::keepVersions(bool keep)
+{
+	isVersioned = keep;
+	if (!keep)
+		versions.clear();
+}
+
+Symbol* SymbolTable::find(unsigned int nameId, unsigned int at) const
+{
+	map<unsigned int, vector<VersionT> >::const_iterator history = versions.find(nameId);
+	if (history == versions.end())
+		return (*this)[nameId];
+	for (size_t i = history->second.size(); i > 0; i--)
+		if (history->second[i - 1].stamp <= at)
+			return history->second[i - 1].sym;
+	return NULL;
+}
+
+/*
+	an ordered table (the global one of an incremental parse) keeps every
+	put of a name with the order of the declaration it came from, so a
+	declaration can be taken out or parsed again at its place. The entry of
+	a name holds what all its puts leave, and a lookup made at some place
+	sees what the puts up to there leave. A put taken out only loses its
+	symbol until settle, so parsing the declaration again at the same order
+	finds its entry where it was. Names put before ordering started are
+	visible everywhere
+*/
+void SymbolTable::keepOrder()
+{
+	isOrdered = true;
+	place = LAST_PLACE;
+	puts.assign(symbols.size(), vector<PutT>());
+	for (size_t i = 0; i < symbols.size(); i++)
+	{
+		PutT put = {0, symbols[i]};
+		puts[i].push_back(put);
+	}
+}
+
+Symbol* SymbolTable::resolve(const vector<PutT>& history, unsigned long long at, bool isChecked)
+{
+	Symbol* s = NULL;
+	for (size_t i = 0; i < history.size() && history[i].order <= at; i++)
+	{
+		Symbol* sym = history[i].sym;
+		if (sym == NULL)
+			continue;
+		if (isChecked && s != NULL && (!sym->equal(s) || s->isParam()))
+			throw ParserException(sym->getLine(), sym->getCol(), "redefinition, different basic types");
+		if (s == NULL || (!s->isInit() && sym->isInit()))
+			s = sym;
+	}
+	return s;
+}
+
+/* a put at the current place; it must also agree with the puts of later declarations */
+Symbol* SymbolTable::putOrdered(Symbol* sym)
+{
+	unsigned int name = sym->getNameId();
+	Symbol* s = (*this)[name];
+	if (s != NULL && (!sym->equal(s) || s->isParam()))
+		throw ParserException(sym->getLine(), sym->getCol(), "redefinition, different basic types");
+	int index = indexOf(name);
+	if (index < 0)
+	{
+		if ((symbols.size() + 1) * 4 > slots.size() * 3)
+			grow();
+		SlotT& slot = slots[slotOf(name)];
+		slot.nameId = name;
+		slot.index = symbols.size() + 1;
+		index = symbols.size();
+		symbols.push_back(NULL);
+		puts.push_back(vector<PutT>());
+	}
+	vector<PutT>& history = puts[index];
+	size_t i = history.size();
+	while (i > 0 && history[i - 1].order > place)
+		i--;
+	PutT put = {place, sym};
+	if (i > 0 && history[i - 1].order == place && history[i - 1].sym == NULL)
+		history[i - 1] = put;
+	else
+		history.insert(history.begin() + i, put);
+	touched.push_back(index);
+	try
+	{
+		symbols[index] = resolve(history, LAST_PLACE, true);
 	}
+	catch (ParserException&)
+	{
+		removePut(sym, place);
+		throw;
+	}
+	return (*this)[name];
 }
 
-Symbol* SymbolTable::operator[](const string& name)
+/* takes back a put of a declaration that is about to be parsed again or is gone */
+void SymbolTable::removePut(Symbol* sym, unsigned long long order)
 {
-	return table.find(name) == table.end() ? NULL : table[name];
+	int index = indexOf(sym->getNameId());
+	if (index < 0)
+		return;
+	vector<PutT>& history = puts[index];
+	for (size_t i = 0; i < history.size(); i++)
+		if (history[i].order == order && history[i].sym == sym)
+			history[i].sym = NULL;
+	symbols[index] = resolve(history, LAST_PLACE, false);
+	touched.push_back(index);
 }
 
-SymbolTableStack::SymbolTableStack()
+bool SymbolTable::isFirstBefore(const vector<PutT>* a, const vector<PutT>* b)
+{
+	return a->front().order < b->front().order;
+}
+
+/*
+	drops the puts taken out since the last settle. Only when a name is
+	gone or its first put moved are the entries sorted by their first put
+	again and the slots built anew
+*/
+void SymbolTable::settle()
+{
+	bool isSorted = true;
+	for (size_t i = 0; i < touched.size(); i++)
+	{
+		vector<PutT>& history = puts[touched[i]];
+		size_t n = 0;
+		for (size_t j = 0; j < history.size(); j++)
+			if (history[j].sym != NULL)
+				history[n++] = history[j];
+		history.resize(n);
+		isSorted = isSorted && n != 0;
+	}
+	for (size_t i = 0; i < touched.size() && isSorted; i++)
+	{
+		size_t k = touched[i];
+		unsigned long long order = puts[k].front().order;
+		isSorted = (k == 0 || puts[k - 1].front().order <= order) && (k + 1 == puts.size() || order <= puts[k + 1].front().order);
+	}
+	touched.clear();
+	if (isSorted)
+		return;
+	vector<vector<PutT>*> entries;
+	for (size_t i = 0; i < puts.size(); i++)
+		if (!puts[i].empty())
+			entries.push_back(&puts[i]);
+	stable_sort(entries.begin(), entries.end(), isFirstBefore);
+	vector<vector<PutT> > sorted(entries.size());
+	for (size_t i = 0; i < entries.size(); i++)
+		sorted[i].swap(*entries[i]);
+	puts.swap(sorted);
+	symbols.resize(puts.size());
+	slots.assign(slots.size(), SlotT());
+	for (size_t i = 0; i < puts.size(); i++)
+	{
+		symbols[i] = resolve(puts[i], LAST_PLACE, false);
+		SlotT& slot = slots[slotOf(symbols[i]->getNameId())];
+		slot.nameId = symbols[i]->getNameId();
+		slot.index = i + 1;
+	}
+}
+
+Symbol* SymbolTable::operator[](unsigned int nameId) const
+{
+	if (slots.empty())
+		return NULL;
+	const SlotT& slot = slots[slotOf(nameId)];
+	if (slot.index == 0)
+		return NULL;
+	if (isOrdered && !puts[slot.index - 1].empty() && puts[slot.index - 1].back().order > place)
+		return resolve(puts[slot.index - 1], place, false);
+	return symbols[slot.index - 1];
+}
+
+/* the position of the symbol in declaration order, -1 when there is none */
+int SymbolTable::indexOf(unsigned int nameId) const
+{
+	if (slots.empty())
+		return -1;
+	return (int)slots[slotOf(nameId)].index - 1;
+}
+
+SymbolTableStack::SymbolTableStack() : global(new SymbolTable()), nameCount(0), globalPuts(NULL), globalLookups(NULL), globalStamp(0), isShared(false)
+{
+	putBuiltins();
+}
+
+void SymbolTableStack::putBuiltins()
 {
-	push(new SymbolTable());
 	putSymbol(_void);
 	putSymbol(_float);
 	putSymbol(_double);
 	putSymbol(_int);
-	_printf->assignType(new SymTypeFunc(_int, vector<Symbol*>()), false);
-	_scanf->assignType(new SymTypeFunc(_int, vector<Symbol*>()), false);
 	putSymbol(_printf);
 	putSymbol(_scanf);
-};
+}
+
+/*
+	while recording, every symbol put into the global table and every name
+	found there is reported, so a top-level declaration can later be
+	replayed or re-parsed on its own
+*/
+void SymbolTableStack::record(vector<Symbol*>* puts, vector<unsigned int>* lookups)
+{
+	globalPuts = puts;
+	globalLookups = lookups;
+}
+
+void SymbolTableStack::clearScopes()
+{
+	scopes.clear();
+	bindings.clear();
+	names.clear();
+	nameCount = 0;
+}
+
+void SymbolTableStack::resetGlobal()
+{
+	delete global;
+	global = new SymbolTable();
+	clearScopes();
+	functions.clear();
+	vars.clear();
+	putBuiltins();
+}
+
+/* a worker's stack reads the owner's global table as of stamp and never writes to it */
+void SymbolTableStack::shareGlobal(SymbolTable* table, unsigned int stamp)
+{
+	delete global;
+	global = table;
+	clearScopes();
+	globalStamp = stamp;
+	isShared = true;
+}
+
+void SymbolTableStack::putGlobal(Symbol* sym)
+{
+	global->putSymbol(sym);
+}
 
 SymbolTable* SymbolTableStack::getGlobal()
 {
-	return *symTableStack.begin();
+	return global;
 }
 
 SymbolTableStack::~SymbolTableStack(){};
 
-void SymbolTableStack::push(SymbolTable* table)
+/* the slot of a name in the index of innermost bindings; names stay in it once they are bound */
+size_t SymbolTableStack::nameOf(unsigned int nameId) const
 {
-	symTableStack.push_front(table);
-	if (symTableStack.size() == 1)
-		ptr = symTableStack.begin();
-	else
-		--ptr;
-	table->getLevel() = symTableStack.size() - 1;
+	size_t mask = names.size() - 1;
+	size_t i = hashName(nameId, mask);
+	while (names[i].nameId != 0 && names[i].nameId != nameId + 1)
+		i = (i + 1) & mask;
+	return i;
 }
 
-void SymbolTableStack::pop()
+int SymbolTableStack::findBinding(unsigned int nameId) const
 {
-	symTableStack.pop_front();
-	ptr = symTableStack.begin();
+	if (names.empty())
+		return -1;
+	const NameT& name = names[nameOf(nameId)];
+	return name.nameId == 0 ? -1 : name.binding;
 }
 
-Symbol* SymbolTable::next()
+int& SymbolTableStack::innermost(unsigned int nameId)
 {
-	return index >= orderList.size() ? NULL : (*this)[orderList[index++]];	
+	if ((nameCount + 1) * 4 > names.size() * 3)
+	{
+		vector<NameT> old(max(names.size() * 2, (size_t)MIN_SLOTS));
+		old.swap(names);
+		for (size_t i = 0; i < old.size(); i++)
+			if (old[i].nameId != 0)
+				names[nameOf(old[i].nameId - 1)] = old[i];
+	}
+	NameT& name = names[nameOf(nameId)];
+	if (name.nameId == 0)
+	{
+		name.nameId = nameId + 1;
+		name.binding = -1;
+		++nameCount;
+	}
+	return name.binding;
 }
 
-Symbol* SymbolTable::first()
+void SymbolTableStack::push()
 {
-	index = 0;
-	return (*this)[orderList[index++]];	
+	ScopeT scope = {NULL, bindings.size()};
+	scopes.push_back(scope);
 }
 
-Symbol* SymbolTable::last()
+/* leaves the innermost block and returns its table, NULL if it declared nothing */
+SymbolTable* SymbolTableStack::pop()
 {
-	return orderList.size() == 0 ? NULL : (*this)[orderList[orderList.size() - 1]];
+	ScopeT scope = scopes.back();
+	for (size_t i = bindings.size(); i > scope.bindings; i--)
+		innermost(bindings[i - 1].nameId) = bindings[i - 1].shadowed;
+	bindings.resize(scope.bindings);
+	scopes.pop_back();
+	return scope.table;
 }
 
-Symbol* SymbolTable::at(int i)
+void SymbolTableStack::putSymbol(Symbol* sym)
 {
-	return orderList.size() == 0  || orderList.size() <= index ? NULL : (*this)[orderList[i]];
+	if (scopes.empty())
+	{
+		global->putSymbol(sym);
+		if (globalPuts != NULL)
+			globalPuts->push_back(sym);
+		return;
+	}
+	ScopeT& scope = scopes.back();
+	if (scope.table == NULL)
+		scope.table = new SymbolTable();
+	Symbol* bound = scope.table->putSymbol(sym);
+	int& binding = innermost(sym->getNameId());
+	if (binding >= (int)scope.bindings)
+	{
+		bindings[binding].sym = bound;
+		return;
+	}
+	BindingT shadow = {sym->getNameId(), bound, binding};
+	binding = bindings.size();
+	bindings.push_back(shadow);
 }
 
-void SymbolTableStack::putSymbol(Symbol* sym)
+/* the visible symbol of that name, NULL when there is none */
+Symbol* SymbolTableStack::findSymbol(const Token& name)
 {
-	(*ptr)->putSymbol(sym);
+	int binding = findBinding(name.textId);
+	if (binding >= 0)
+		return bindings[binding].sym;
+	Symbol* sym = isShared ? global->find(name.textId, globalStamp) : (*global)[name.textId];
+	if (sym != NULL && globalLookups != NULL)
+		globalLookups->push_back(name.textId);
+	return sym;
 }
 
 Symbol* SymbolTableStack::getSymbol(const Token& name)
 {
-	Symbol *sym = NULL;
-	iter i = ptr;
-	SymbolTable* t = NULL;
-	for (; i != symTableStack.end() && sym == NULL; i++)
-	{
-		t = *i;
-		sym = (*t)[name.text];
-	}
+	Symbol* sym = findSymbol(name);
 	if (sym == NULL)
-		throw ParserException(name.line, name.col, "identifier " + name.text + " is undefined");
+		throw ParserException(name.getLine(), name.getCol(), "identifier " + name.getText() + " is undefined");
 	return sym;
 }
 
 bool SymbolTableStack::hasSymbolInCurrTable(const Token& name)
 {
-	SymbolTable* t = *ptr;
-	return (*t)[name.text] != NULL && name.text[name.text.length() - 1] != '{';
+	bool isFound = scopes.empty() ? (*global)[name.textId] != NULL : findBinding(name.textId) >= (int)scopes.back().bindings;
+	return isFound && name.getText()[name.getText().length() - 1] != '{';
 }
 
 void SymType::print(string out, bool printDecl = true)
@@ -168,12 +506,15 @@ void SymTypeArray::print(string out, bool printDecl = true)
 
 void SymVar::print(string out, bool printDecl = true)
 {	
-	cout << out + name.text << " : ";
+	cout << out + name.getText() << " : ";
 	type->print("", printDecl && *type != STRUCT);
 	if (printDecl && initializer != NULL)
 	{
 		cout << endl << out + "initializer :" << endl;
-		initializer->print(out, printDecl);
+		if (flat != NULL)
+			flat->print(flatRoot, out, printDecl);
+		else
+			initializer->print(out, printDecl);
 	}
 }
 
@@ -198,9 +539,9 @@ void SymTypeFunc::print(string out, bool printDecl = true)
 
 void SymbolTable::print(string out, bool printDecl = true)
 {
-	int i = 0;
+	size_t i = 0;
 	bool p = printDecl;
-	while (i != table.size())
+	while (i != symbols.size())
 	{
 		printDecl = p;
 		if (out.size() == 0 && i < 6)
@@ -208,23 +549,41 @@ void SymbolTable::print(string out, bool printDecl = true)
 			cout << "<base> type : ";
 			printDecl = false;
 		}
-		table[orderList[i++]]->print(out, printDecl);
+		symbols[i++]->print(out, printDecl);
 		cout << endl;
 	}
 }
 
 void SymbolTableStack::print()
 {
-	(*ptr)->print("");
+	if (getTable() != NULL)
+		getTable()->print("");
 }
 
-void SymTypePointer::assign(SymType* t, bool e) 
+/*
+	a pointer may be shared, so completing a declarator rebuilds the
+	pointers above the innermost type instead of changing them; arrays and
+	functions belong to their declarator and are completed in place
+*/
+SymType* SymTypePointer::assign(SymType* t, bool e) 
 {
-	SymTypePointer *root = this;
-	if (e && (*root->to == ARRAY || *root->to == FUNCTION) || !e && root->to->isPointer())
-		root->to->assign(t, *root->to == POINTER);
-	else
-		root->to = t;
+	if ((e && (*to == ARRAY || *to == FUNCTION)) || (!e && to->isPointer()))
+		t = to->assign(t, *to == POINTER);
+	if (type == POINTER)
+		return canonical(t);
+	to = t;
+	return this;
+}
+
+/* pointers are hash consed: the arena of the compilation keeps one per pointee, so equal pointers are mostly the same object */
+SymTypePointer* SymTypePointer::canonical(SymType* to)
+{
+	void** slot = Arena::unique(to);
+	if (slot == NULL)
+		return new SymTypePointer(to);
+	if (*slot == NULL)
+		*slot = new SymTypePointer(to);
+	return static_cast<SymTypePointer*>(*slot);
 }
 
 void SymVar::assignType(SymType* t, bool isP) 
@@ -233,7 +592,7 @@ void SymVar::assignType(SymType* t, bool isP)
 		static_cast<SymTypePointer*>(t)->assignVar(this);
 
 	if (!isP && type->isPointer() && *type != POINTER || isP && type->isPointer())
-		type->assign(t, *type == POINTER);
+		type = type->assign(t, *type == POINTER);
 	else
 		type = t;
 }
@@ -247,9 +606,9 @@ void SymTypeEnumConst::print(string out, bool printDecl = true)
 
 void SymTypeRecord::print(string out, bool printDeclaration = true)
 {
-	cout << out + name.text + " ";
+	cout << out + name.getText() + " ";
 	if (table == NULL)
-		throw ParserException(name.line, name.col, name.text + " is undefined record(struct or enum)");
+		throw ParserException(name.getLine(), name.getCol(), name.getText() + " is undefined record(struct or enum)");
 	if (printDeclaration)
 	{
 		cout << endl << out + " {" << endl;
@@ -268,14 +627,9 @@ void SymTypeEnum::print(string out, bool printDecl = true)
 	SymTypeRecord::print(out, printDecl);
 }
 
-size_t SymbolTable::size() const
-{
-	return table.size();
-}
-
 bool SymType::equal(Symbol* a)
 {
-	return a != NULL && *static_cast<SymType*>(a) == type;
+	return a == this || (a != NULL && *static_cast<SymType*>(a) == type);
 }
 
 bool static isEqualFunctions(SymTypeFunc* f1, SymTypeFunc* f2)
@@ -291,6 +645,8 @@ bool static isEqualFunctionDis(SymTypePointer* p, SymTypeFunc* f)
 
 bool SymTypePointer::equal(Symbol* a)
 {
+	if (a == this)
+		return true;
 	if (a != NULL && *a == FUNCTION)
 		return isEqualFunctionDis(this, static_cast<SymTypeFunc*>(a));
 	return a != NULL && a->isPointer() &&  to->equal(static_cast<SymTypePointer*>(a)->to);
@@ -298,8 +654,8 @@ bool SymTypePointer::equal(Symbol* a)
 
 void SymVar::init(void* initList)
 {
-	Token assignment = Token(getLine(), getCol());
-	assignment.setTag(OP_ASSIGN, "=", "=");
+	Token assignment = Token(name.offset);
+	assignment.setTag(OP_ASSIGN, "=");
 	initializer = (*type == FUNCTION || *type == ARRAY) ? static_cast<ExprNode*>(initList) : tryCastInAssignment(getType(), static_cast<ExprNode*>(initList), assignment);
 }
 
@@ -315,7 +671,7 @@ void SymbolTableStack::init(Symbol* var, void* init)
 	if (hasSymbolInCurrTable(name))
 		s = getSymbol(name);
 	if (s != NULL && s->isInit())
-		throw ParserException(name.line, name.col, "redefinition; multiple initialization");
+		throw ParserException(name.getLine(), name.getCol(), "redefinition; multiple initialization");
 	var->init(init);
 	putSymbol(var);
 }
@@ -353,15 +709,17 @@ bool SymTypeArray::equal(Symbol* a)
 
 bool SymTypeRecord::equal(Symbol *a)
 {
-	return a != NULL && *a == STRUCT && name.text == a->getName();
+	return a != NULL && *a == STRUCT && name.getText() == a->getName();
 }
 
 void SymbolTableStack::initFunctionsAndVarsArray()
 {
 	SymbolTable* gl = getGlobal();
-	Symbol* currSym = NULL;
-	while ((currSym = gl->next()) != NULL)
+	functions.clear();
+	vars.clear();
+	for (size_t i = 0; i < gl->size(); i++)
 	{
+		Symbol* currSym = gl->at(i);
 		if (*currSym == FUNCTION)
 		{
 			functions.push_back(currSym);
@@ -380,38 +738,39 @@ void SymVar::gen(CodeGen& gen)
 		throw SemanticsException(getLine(), getCol(), "initializer must be a const");
 }
 
-void SymVarLocal::gen(CodeGen& gen)
+/* the initializer is generated from its flattened copy, so the tree has to be flattened after the folding */
+void SymVar::genInitializer(CodeGen& gen)
 {
-	asmName = getPrefix(asmName, PREFIX_LOCAL);
+	if (flat == NULL)
+		throw logic_error("the initializer of " + name.getText() + " is not flattened");
+	flat->gen(flatRoot, gen);
 }
 
 void SymVarGlobal::gen(CodeGen& gen)
 {
-	if (asmName == "printf" || asmName == "scanf")
+	if (name.textId == _printf->getNameId() || name.textId == _scanf->getNameId())
 	{
-		asmName = "_imp__" + asmName;
+		if (asmName.empty())
+			asmName = "_imp__" + name.getText();
 		return;
 	}
 
 	SymVar::gen(gen);
 			
+	if (*this != FUNCTION && getType()->getAlign() > 4)
+		gen.addAlign(getType()->getAlign());
 	if (*this == INT || *this == FLOAT || *this == POINTER)
-		gen.addDD(asmName = getPrefix(asmName, PREFIX_GLOBAL), *this != POINTER  && isInit() ? initializer->getValue(*this != INT) : to_string(0), 4);
+		gen.addDD(asmName = getPrefix(name.getText(), PREFIX_GLOBAL), *this != POINTER  && isInit() ? initializer->getValue(*this != INT) : to_string(0), 4);
 	if (*this == DOUBLE)
-		gen.addDQ(asmName = getPrefix(asmName, PREFIX_GLOBAL), isInit() ? initializer->getValue(2) : to_string(0), 8);
+		gen.addDQ(asmName = getPrefix(name.getText(), PREFIX_GLOBAL), isInit() ? initializer->getValue(2) : to_string(0), 8);
 	if (*this == FUNCTION || *this == ARRAY || *this == STRUCT)
 	{
 		if (*this != FUNCTION)
-			gen.addData(asmName = getPrefix(asmName, PREFIX_GLOBAL));
+			gen.addData(asmName = getPrefix(name.getText(), PREFIX_GLOBAL));
 		getType()->gen(gen);
 	}
 }
 
-void SymVarParam::gen(CodeGen& gen)
-{
-	asmName = getPrefix(asmName, PREFIX_PARAM);
-}
-
 void SymTypeFunc::gen(CodeGen& gen)
 {
 	if (var->getName() == "printf" || var->getName() == "scanf")
@@ -425,21 +784,50 @@ void SymTypeFunc::gen(CodeGen& gen)
 	if (*dereference() != VOID)
 		gen.addLocalVars(string(RET_ADDR), to_string(retShift + dereference()->getSize()));
 
-	static_cast<StmtCompound*>(body)->gen(gen);
+	var->genInitializer(gen);
 
 	gen.genPrologue(pShift);
 	gen.addLabel(RET_LABEL(var->getName()));
 	gen.genEpilogue(pShift);
 }
 
+/*
+	the layout is computed once, on first use, when every member is
+	complete: each member is put at the next multiple of its own alignment
+	(a double at 8, so movsd never straddles a cache line) and the size is
+	rounded up to the strictest alignment, so array elements stay aligned
+*/
+void SymTypeRecord::layout()
+{
+	if (align != 0 || table == NULL)
+		return;
+	size_t offset = 0;
+	align = 1;
+	offsets.resize(table->size());
+	for (size_t i = 0; i < table->size(); i++)
+	{
+		SymType* type = table->at(i)->getType();
+		size_t a = max(type->getAlign(), (size_t)1);
+		offset = (offset + a - 1) / a * a;
+		offsets[i] = offset;
+		offset += type->getSize();
+		align = max(align, a);
+	}
+	size = (offset + align - 1) / align * align;
+}
+
 size_t SymTypeRecord::getSize()
 {
-	Symbol* sym;
-	for(size != 0; (sym = table->next()) != NULL;)
-		size += sym->getType()->getSize();
+	layout();
 	return size;
 }
 
+size_t SymTypeRecord::getAlign()
+{
+	layout();
+	return align;
+}
+
 void SymTypeStruct::gen(CodeGen& gen)
 {
 	gen.addDB(string(), to_string(getSize()) + " dup(?)");
@@ -447,22 +835,21 @@ void SymTypeStruct::gen(CodeGen& gen)
 
 void SymTypeArray::gen(CodeGen& gen)
 {
-	InitList* list = static_cast<InitList*>(var->getInitializer());
-	if (list == NULL)
+	if (var->getInitializer() == NULL)
 	{
 		SymType* type = dereference();
-		while(type->isPointer())
+		while(*type == ARRAY)
 			type = static_cast<SymTypePointer*>(type)->dereference();
-		string value = to_string(getArraySize()) + " dup(?)";
-		switch(type->getSize())
-		{
-		case 1 : gen.addDB(string(), value);break;
-		case 4 : gen.addDD(string(), value, 4);break;
-		case 8 : gen.addDB(string(), value);break;
-		}
+		size_t size = type->getSize(), count = getSize() / max(size, (size_t)1);
+		if (size == 4)
+			gen.addDD(string(), to_string(count) + " dup(?)", 4);
+		else if (size == 8)
+			gen.addDQ(string(), to_string(count) + " dup(?)", 8);
+		else
+			gen.addDB(string(), to_string(getSize()) + " dup(?)");
 		return;
 	}
-	list->gen(gen);
+	var->genInitializer(gen);
 }
 
 size_t SymTypeArray::getArraySize()
@@ -481,6 +868,40 @@ size_t SymTypeArray::getArraySize()
 	return arraySize;
 }
 
+void SymTypeArray::foldLength()
+{
+	if (length != NULL && arraySize == -1)
+		length = length->fold();
+}
+
+/* array lengths are folded wherever they sit in a declarator, so getArraySize reads a literal */
+static void foldType(SymType* type)
+{
+	while (type->isPointer() && *type != FUNCTION)
+	{
+		if (*type == ARRAY)
+			static_cast<SymTypeArray*>(type)->foldLength();
+		type = static_cast<SymTypePointer*>(type)->dereference();
+	}
+}
+
+/* a global's initializer or a function's body; a local's initializer is folded as the assignment it became */
+void SymVar::fold()
+{
+	foldType(type);
+	if (initializer == NULL || !isGlobal())
+		return;
+	SyntaxNode* folded = initializer->fold();
+	if (folded != initializer)
+		initializer = folded;
+}
+
+void SymTypeStruct::fold()
+{
+	for (size_t i = 0; table != NULL && i < table->size(); i++)
+		table->at(i)->fold();
+}
+
 size_t SymTypeArray::getSize()
 {
 	SymType* type = dereference();
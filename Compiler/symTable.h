@@ -5,6 +5,7 @@
 #include "scanner.h"
 #include <list>
 #include "syntaxNode.h"
+#include "arena.h"
 
 typedef enum  
 {
@@ -27,14 +28,15 @@ class SymbolTable;
 class SymVar;
 class SymType;
 class CodeGen;
+class FlatTree;
 
-extern SymType* _void;
-extern SymType* _float;
-extern SymType* _double;
-extern SymType* _int;
+extern SymType* const _void;
+extern SymType* const _float;
+extern SymType* const _double;
+extern SymType* const _int;
 
-extern SymVar* _printf;
-extern SymVar* _scanf;
+extern SymVar* const _printf;
+extern SymVar* const _scanf;
 
 class Symbol
 {
@@ -45,9 +47,11 @@ private:
 public:
 
 	Symbol(){};
+	virtual ~Symbol(){}
 	virtual void print(string out, bool printDecl){};
 	virtual void gen(CodeGen&){};
 	virtual string getName(){return string();};
+	virtual unsigned int getNameId(){return Token::internText(getName());}
 	virtual bool isInit(){return false;};
 	virtual bool equal (Symbol* a){return false;};
 	virtual bool isPointer(){return false;};
@@ -63,6 +67,12 @@ public:
 	virtual bool isLocal(){return false;}
 	virtual bool isParam(){return false;}
 	virtual bool isGlobal(){return false;}
+	virtual bool isEnumConst(){return false;}
+	virtual void fold(){};
+
+	static void destroy(void* p){static_cast<Symbol*>(p)->~Symbol();}
+	static void* operator new(size_t size){return Arena::allocate(SYMBOL_ARENA, size, destroy);}
+	static void operator delete(void* p){Arena::release(p);}
 };
 
 
@@ -79,8 +89,9 @@ public :
 	bool operator==(TypeT t){return type == t;}
 	bool operator!=(TypeT t){return !(type == t);}
 	virtual string getName(){return TypeText[type];}
-	virtual void assign(SymType* a, bool e){};
+	virtual SymType* assign(SymType* a, bool e){return this;};
 	virtual size_t getSize(){return 0;}
+	virtual size_t getAlign(){return getSize();}
 };
 
 class SymVar : public Symbol
@@ -90,25 +101,32 @@ protected :
 	SymType* type;
 	SyntaxNode* initializer;
 	string asmName;
+	const FlatTree* flat;
+	unsigned int flatRoot;
 public :
 
-	SymVar(const Token _name, SymType *t, SyntaxNode* i) : type(t), name(_name), initializer(i){asmName = name.text;}
+	SymVar(const Token _name, SymType *t, SyntaxNode* i) : name(_name), type(t), initializer(i), flat(NULL), flatRoot(0){}
 	virtual SymType* getType() {return type;}
 	virtual void print(string out, bool printDecl);
 	virtual void assignType(SymType* type, bool isP);
 	virtual void init(void* init);
 	virtual bool isInit(){return initializer != NULL;}
 	virtual bool equal (Symbol* a);
-	virtual string getName(){return name.text;}
+	virtual string getName(){return name.getText();}
+	virtual unsigned int getNameId(){return name.textId;}
 	virtual Token& getTokenName(){return name;}
-	virtual int getLine(){return name.line;}
-	virtual int getCol(){return name.col;}
+	virtual int getLine(){return name.getLine();}
+	virtual int getCol(){return name.getCol();}
 	bool operator==(TypeT t){return *type == t;};
 	bool operator!=(TypeT t){return !(*type == t);}
 	bool isVar(){return true;}
-	string& getAsmName(){return asmName;}
+	const string& getAsmName(){return asmName.empty() ? name.getText() : asmName;}
+	void setAsmName(const string& _asmName){asmName = _asmName;}
 	SyntaxNode* getInitializer(){return initializer;}
+	void setFlat(const FlatTree* tree, unsigned int root){flat = tree; flatRoot = root;}
+	void genInitializer(CodeGen& gen);
 	virtual void gen(CodeGen&);
+	virtual void fold();
 };
 
 
@@ -126,18 +144,24 @@ protected :
 
 	SymbolTable* table;
 	Token name;
-	size_t size;
+	size_t size, align;
+	vector<unsigned int> offsets;
+
+	void layout();
 public :
 
-	SymTypeRecord(Token _name) : name(_name), SymType(UNDEF){table = NULL; size = 0;}
+	SymTypeRecord(Token _name) : SymType(UNDEF), name(_name){table = NULL; size = 0; align = 0;}
 	virtual void print(string out, bool printDecl);
 	bool isInit() {return table != NULL;}
 	SymbolTable* getTable(){return table;}
-	string getName(){return name.text;}
+	string getName(){return name.getText();}
+	unsigned int getNameId(){return name.textId;}
 	bool equal(Symbol* a);
 	virtual void init(void* init);
 	Token& getTokenName(){return name;} 
 	virtual size_t getSize();
+	virtual size_t getAlign();
+	unsigned int getOffset(size_t field){layout(); return offsets[field];}
 };
 
 class SymTypeStruct : public SymTypeRecord
@@ -147,6 +171,7 @@ public :
 	SymTypeStruct(Token _name) : SymTypeRecord(_name){type = STRUCT;};
 	void print(string out, bool printDecl);
 	void gen(CodeGen&);
+	void fold();
 };
 
 class SymTypeEnum : public SymTypeRecord
@@ -156,6 +181,8 @@ public :
 	SymTypeEnum(Token _name) : SymTypeRecord(_name){type = ENUM;};
 	void print(string out, bool printDecl);
 	void gen(CodeGen&){};
+	size_t getSize(){return 4;}
+	size_t getAlign(){return 4;}
 };
 
 class SymTypeVoid : public SymType
@@ -200,13 +227,15 @@ public :
 
 	SymTypePointer(SymType* _to) : SymType(POINTER){to = _to;}
 	virtual void print(string out, bool printDecl);
-	virtual void assign(SymType* t, bool e);
+	virtual SymType* assign(SymType* t, bool e);
 	virtual SymType* dereference(){return to;}
 	virtual bool equal (Symbol* a);
 	virtual void gen(CodeGen&){};
 	virtual void assignVar(SymVar* var){};
 	bool isPointer(){return true;}
 	size_t getSize(){return 4;}
+
+	static SymTypePointer* canonical(SymType* to);
 };
 
 class SymTypeArray : public SymTypePointer
@@ -225,7 +254,9 @@ public :
 	void gen(CodeGen&);
 	void assignVar(SymVar* _var){var = _var;}
 	size_t getSize();
+	size_t getAlign(){return dereference()->getAlign();}
 	size_t getArraySize();
+	void foldLength();
 	SyntaxNode* getInitList(){return isInit() && var != NULL ? var->getInitializer() : NULL;}
 	string getVarAsmName(){return var->getAsmName();}
 	bool isGlobal(){return var->isGlobal();}
@@ -260,7 +291,7 @@ class SymVarParam : public SymVar
 public :
 
 	SymVarParam(const Token _name, SymType *type, SyntaxNode* i) : SymVar(_name, type, i){};
-	void gen(CodeGen&);
+	void gen(CodeGen&){};
 	bool isInit(){return true;}
 	bool isParam(){return true;}
 };
@@ -273,10 +304,14 @@ private :
 	SymTypeEnum* enumType;
 public :
 
-	SymTypeEnumConst(Token name, int idx, SymTypeEnum* t) : SymVar(name, t, NULL), index(idx){};//IntegerNode()
+	SymTypeEnumConst(Token name, int idx, SymTypeEnum* t) : SymVar(name, _int, NULL), index(idx), enumType(t){};
 	void print(string out, bool printDecl);
 	virtual bool isInit() {return true;}
+	bool isVar(){return false;}
+	bool isEnumConst(){return true;}
+	int getIndex(){return index;}
 	void gen(CodeGen&){};
+	void fold(){};
 };
 
 class SymVarLocal : public SymVar
@@ -284,7 +319,7 @@ class SymVarLocal : public SymVar
 public :
 
 	SymVarLocal(Token _name, SymType *type, SyntaxNode* i) : SymVar(_name, type, i){};
-	void gen(CodeGen&);
+	void gen(CodeGen&){};
 	bool isLocal(){return true;}
 };
 
@@ -299,49 +334,133 @@ public :
 
 class SymbolTable
 {
-typedef map<string, Symbol*>::iterator iter;
+typedef map<unsigned int, Symbol*>::iterator iter;
 
 private :
 
-	map<string, Symbol*> table;
-	vector<string> orderList;
-	int index, level;
+	typedef struct
+	{
+		unsigned int stamp;
+		Symbol* sym;
+	}VersionT;
+
+	typedef struct
+	{
+		unsigned int nameId, index;
+	}SlotT;
+
+	typedef struct
+	{
+		unsigned long long order;
+		Symbol* sym;
+	}PutT;
+
+	vector<Symbol*> symbols;
+	vector<SlotT> slots;
+	map<unsigned int, vector<VersionT> > versions;
+	unsigned int stamp;
+	bool isVersioned;
+	vector<vector<PutT> > puts;
+	vector<size_t> touched;
+	unsigned long long place;
+	bool isOrdered;
+
+	size_t slotOf(unsigned int nameId) const;
+	void grow();
+	Symbol* putOrdered(Symbol* sym);
+	static Symbol* resolve(const vector<PutT>& history, unsigned long long at, bool isChecked);
+	static bool isFirstBefore(const vector<PutT>* a, const vector<PutT>* b);
 public :
 
+	static const unsigned long long LAST_PLACE = ~0ULL;
+
 	SymbolTable();
-	void putSymbol(Symbol *sym);
-	Symbol* operator[](const string& name);
+	Symbol* putSymbol(Symbol *sym);
+	Symbol* operator[](unsigned int nameId) const;
+	int indexOf(unsigned int nameId) const;
 	void print(string out, bool printDecl);
-	size_t size() const;
-	Symbol* next();
-	Symbol* first();
-	Symbol* last();
-	Symbol* at(int index);
-	int& getLevel(){return level;}
+	size_t size() const {return symbols.size();}
+	Symbol* last() const {return symbols.empty() ? NULL : symbols.back();}
+	Symbol* at(size_t index) const {return index < symbols.size() ? symbols[index] : NULL;}
+	void keepVersions(bool keep);
+	unsigned int getStamp() const {return stamp;}
+	Symbol* find(unsigned int nameId, unsigned int at) const;
+	void keepOrder();
+	void setPlace(unsigned long long at){place = at;}
+	void removePut(Symbol* sym, unsigned long long order);
+	void settle();
+
+	static void destroy(void* p){static_cast<SymbolTable*>(p)->~SymbolTable();}
+	static void* operator new(size_t size){return Arena::allocate(TABLE_ARENA, size, destroy);}
+	static void operator delete(void* p){Arena::release(p);}
 };
 
+/*
+	the global table is looked up directly; every name declared in a block
+	gets a binding that remembers the one it shadows, and a single hash of
+	name ids points at the innermost binding of each name, so a lookup
+	costs the same at any depth. Leaving a block undoes its bindings, and
+	its table is only created when it declares something
+*/
 class SymbolTableStack
 {
-typedef list<SymbolTable*>::iterator iterator;
-
 private :
 
-	list<SymbolTable*> symTableStack;
-	iterator ptr;
+	typedef struct
+	{
+		unsigned int nameId;
+		Symbol* sym;
+		int shadowed;
+	}BindingT;
+
+	typedef struct
+	{
+		SymbolTable* table;
+		size_t bindings;
+	}ScopeT;
+
+	typedef struct
+	{
+		unsigned int nameId;
+		int binding;
+	}NameT;
+
+	SymbolTable* global;
+	vector<ScopeT> scopes;
+	vector<BindingT> bindings;
+	vector<NameT> names;
+	size_t nameCount;
 	vector<Symbol*> functions, vars;
+	vector<Symbol*>* globalPuts;
+	vector<unsigned int>* globalLookups;
+	unsigned int globalStamp;
+	bool isShared;
+
+	void putBuiltins();
+	size_t nameOf(unsigned int nameId) const;
+	int& innermost(unsigned int nameId);
+	int findBinding(unsigned int nameId) const;
+	void clearScopes();
 public :
 
 	SymbolTableStack();
 	~SymbolTableStack();
-	void push(SymbolTable* symTable);
-	void pop();
+	void record(vector<Symbol*>* puts, vector<unsigned int>* lookups);
+	void resetGlobal();
+	void shareGlobal(SymbolTable* global, unsigned int stamp);
+	void putGlobal(Symbol* sym);
+	void push();
+	SymbolTable* pop();
+	SymbolTable* getTable(){return scopes.empty() ? global : scopes.back().table;}
 	void putSymbol(Symbol* sym);
+	Symbol* findSymbol(const Token& name);
 	Symbol* getSymbol(const Token& name);
 	bool hasSymbolInCurrTable(const Token& name);
 	void print();
 	void init(Symbol* var, void* init);
 	SymbolTable* getGlobal();
-	bool isGlobal(){return ptr == --symTableStack.end();}
+	bool isGlobal(){return scopes.empty();}
+	size_t size() const {return scopes.size() + 1;}
 	void initFunctionsAndVarsArray();
 	vector<Symbol*> getFunctions(){return functions;}
 	vector<Symbol*> getVars(){return vars;}
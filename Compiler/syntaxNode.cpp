@@ -18,15 +18,17 @@ SyntaxNode::~SyntaxNode() {};
 void SyntaxNode::print(string str, bool isTail)
 {
 	string out = (str.size() == 0 ? "-->" : "|__");
-	cout << str + out << token.text << " ";
+	cout << str + out << token.getSpelling() << " ";
 }
 
-string SyntaxNode::getValue(int type)
+/* the constant in token as an operand: 0 an int, 1 the bits of a float, 2 the bits of a double */
+string SyntaxNode::getValue(const Token& token, int type)
 {
+	double value = token.floatValue();
 	switch(type)
 	{
-	case 0 : return to_string(token.val.iValue);
-	case 1 : {float f = (float)token.val.fValue; return to_string(*(int*)&token.val.fValue);}
-	case 2 : return to_string(*((long long*)&token.val.fValue));
+	case 0 : return to_string(token.intValue());
+	case 1 : return to_string(*(int*)&value);
+	case 2 : return to_string(*((long long*)&value));
 	}																
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "token.h"
+#include "arena.h"
 
 using namespace std;
 
@@ -15,13 +16,20 @@ public :
 
 	SyntaxNode();
 	SyntaxNode(Token _token);
-	~SyntaxNode();
+	virtual ~SyntaxNode();
 	SyntaxNode(SyntaxNode &node);
 
 	virtual void print(string str, bool isTail);
-	string& getName(){return token.text;}
-	string getValue(int type);
-	int getLine(){return token.line;}
-	int getCol(){return token.col;}
+	virtual SyntaxNode* fold(){return this;}
+	const string& getName(){return token.getText();}
+	const Token& getToken(){return token;}
+	string getValue(int type){return getValue(token, type);}
+	static string getValue(const Token& token, int type);
+	int getLine(){return token.getLine();}
+	int getCol(){return token.getCol();}
 	virtual SymbolTable* getTable(){return NULL;}
+
+	static void destroy(void* p){static_cast<SyntaxNode*>(p)->~SyntaxNode();}
+	static void* operator new(size_t size){return Arena::allocate(NODE_ARENA, size, destroy);}
+	static void operator delete(void* p){Arena::release(p);}
 };
\ No newline at end of file
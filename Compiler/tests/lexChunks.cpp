@@ -0,0 +1,118 @@
+#include "../scanner.h"
+#include <string.h>
+#include <stdlib.h>
+
+/*
+	lexes generated inputs serially and with several threads and expects
+	the same tokens and the same first error; it is built against a
+	scanner.cpp compiled with a small MIN_LEX_CHUNK (see the test target
+	of the Makefile), so comments, strings and char constants keep
+	crossing the chunk boundaries
+*/
+
+#define CASES 400
+#define MAX_THREADS 8
+
+typedef struct
+{
+	vector<Token> tokens;
+	string error;
+}LexResultT;
+
+static const char* PIECES[] =
+{
+	"int", "while", "return", "x", "_tmp1", "main", "0", "42", "0x1F", "017", "1.5", "2.5e3", ".25",
+	"+", "-", "*", "/", "==", "->", "<<=", "&&", ";", "{", "}", "(", ")", ",", "[", "]", "#",
+	"\n", "\n", "\n", " ", " ", "\t",
+	"// line comment with \" ' /* and */ inside\n",
+	"/* block\n comment with \" and ' and // \n */",
+	"/**/", "/* * / */",
+	"\"string with // and /* inside\"", "\"\"", "\"multi word\\n\"",
+	"'x'", "'\"'", "'\\''", "'\\n'", "'/'", "'*'",
+};
+
+/* each one makes the scanner throw */
+static const char* ERRORS[] =
+{
+	"\"open string\n", "'ab'", "09", "*/", "0x", "@", "''",
+};
+
+#define PIECE_COUNT (sizeof(PIECES) / sizeof(PIECES[0]))
+#define ERROR_COUNT (sizeof(ERRORS) / sizeof(ERRORS[0]))
+
+static string generate(unsigned int seed)
+{
+	srand(seed);
+	string text;
+	int count = 50 + rand() % 600;
+	for (int i = 0; i < count; i++)
+	{
+		text += PIECES[rand() % PIECE_COUNT];
+		text += rand() % 3 == 0 ? "\n" : " ";
+	}
+	/* a third of the inputs get one or two errors, so the first one has to win */
+	int errors = seed % 3 == 0 ? 1 + rand() % 2 : 0;
+	for (int i = 0; i < errors; i++)
+	{
+		size_t at = rand() % text.size();
+		while (at < text.size() && text[at] != '\n')
+			at++;
+		text.insert(at, string("\n") + ERRORS[rand() % ERROR_COUNT] + "\n");
+	}
+	return text;
+}
+
+static LexResultT lex(Source_buffer& source, unsigned int threads)
+{
+	LexResultT result;
+	Scanner scanner(&source, 0, source.size());
+	try
+	{
+		scanner.tokenize(result.tokens, threads);
+	}
+	catch (ScannerException &error)
+	{
+		result.error = error.text();
+	}
+	return result;
+}
+
+static bool isSameToken(const Token& a, const Token& b)
+{
+	return a.type == b.type && a.offset == b.offset && a.length == b.length && a.textId == b.textId
+		&& memcmp(&a.val, &b.val, sizeof(a.val)) == 0;
+}
+
+static bool isSame(const LexResultT& a, const LexResultT& b)
+{
+	if (a.error != b.error || a.tokens.size() != b.tokens.size())
+		return false;
+	for (size_t i = 0; i < a.tokens.size(); i++)
+		if (!isSameToken(a.tokens[i], b.tokens[i]))
+			return false;
+	return true;
+}
+
+int main()
+{
+	int failed = 0, errors = 0;
+	for (unsigned int seed = 1; seed <= CASES; seed++)
+	{
+		string text = generate(seed);
+		Source_buffer source(text.data(), text.size());
+		LexResultT serial = lex(source, 1);
+		if (!serial.error.empty())
+			errors++;
+		for (unsigned int threads = 2; threads <= MAX_THREADS; threads++)
+		{
+			LexResultT parallel = lex(source, threads);
+			if (isSame(serial, parallel))
+				continue;
+			failed++;
+			cout << "seed " << seed << ", " << threads << " threads: " << parallel.tokens.size() << " tokens, " << (parallel.error.empty() ? "no error" : parallel.error)
+				<< "; serial " << serial.tokens.size() << " tokens, " << (serial.error.empty() ? "no error" : serial.error) << endl;
+		}
+	}
+	cout << CASES << " inputs, " << errors << " with errors, " << failed << " mismatches" << endl;
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,26 +1,73 @@
 #include "token.h"
+#include "buffer.h"
+#include "intern.h"
+#include <vector>
+#include <sstream>
+#include <iomanip>
 
-Token::Token() : line(0), col(0), type(UNDEFINED){val.strValue = ""; text = "undefined";};
-
-Token::Token(TokenTypeT _type, std::string _strType, std::string _text) : type(_type), text(_text), line(0), col(0) 
+const char* TOKEN_TYPE_NAMES[] = 
 {
-	strType = _strType; 
-	val.strValue = _type == STRING_CONST ? '"' + text + '"' : "nan";
+#define TOKEN(name, text) #name,
+#include "tokenTypes.def"
+#undef TOKEN
 };
 
-Token::~Token() {};
+const char* TOKEN_TEXT[] =
+{
+#define TOKEN(name, text) text,
+#include "tokenTypes.def"
+#undef TOKEN
+}; 
+
+#define TOKEN_TYPES (sizeof(TOKEN_TEXT) / sizeof(TOKEN_TEXT[0]))
+
+/*
+	ids below TOKEN_TYPES are the fixed spellings of TOKEN_TEXT, so a token
+	of type t with the standard spelling just has textId == t; the rest are
+	interned strings shifted by TOKEN_TYPES
+*/
+static const std::string* fixedTexts()
+{
+	static const std::vector<std::string> texts(TOKEN_TEXT, TOKEN_TEXT + TOKEN_TYPES);
+	return &texts[0];
+}
+
+unsigned int Token::internText(const std::string& text)
+{
+	return TOKEN_TYPES + intern(text);
+}
+
+unsigned int Token::internText(const char* text, size_t length)
+{
+	return TOKEN_TYPES + intern(text, length);
+}
+
+Token::Token() : type(UNDEFINED), offset(NO_OFFSET), length(0), textId(UNDEFINED) {val.fValue = 0;}
+
+Token::Token(TokenTypeT _type) : type(_type), offset(NO_OFFSET), length(0), textId(_type) {val.fValue = 0;}
+
+Token::Token(TokenTypeT _type, const std::string& _text) : type(_type), offset(NO_OFFSET), length(0), textId(internText(_text)) 
+{
+	val.fValue = 0;
+	if (_type == STRING_CONST)
+		val.strId = internText('"' + _text + '"');
+}
+
+Token::Token(TokenTypeT _type, const char* _text, size_t _length) : type(_type), offset(NO_OFFSET), length(0), textId(internText(_text, _length)) {val.fValue = 0;}
+
+Token::Token(unsigned int _offset) : type(UNDEFINED), offset(_offset), length(0), textId(UNDEFINED) {val.fValue = 0;}
 
 std::ostream& operator<< (std::ostream &s, Token tok)
 {
-	s << "(" << tok.line << "," << tok.col << ") " << "\ttype\t" + tok.strType << "\tvalue\t";
+	s << "(" << tok.getLine() << "," << tok.getCol() << ") " << "\ttype\t" << tok.getTypeName() << "\tvalue\t";
 	if  (tok.type == INT_CONST)
 		s << tok.val.iValue;
 	else
 		if (tok.type == DOUBLE_CONST)
 			s << tok.val.fValue;
 	else
-		s << tok.val.strValue;
-	return s << "\ttext\t" + tok.text; 
+		s << tok.strValue();
+	return s << "\ttext\t" + tok.getText(); 
 }
 
 Token::operator TokenTypeT() const
@@ -28,27 +75,98 @@ Token::operator TokenTypeT() const
 	return type;
 }
 
+const std::string& Token::textOf(unsigned int id)
+{
+	return id < TOKEN_TYPES ? fixedTexts()[id] : internedText(id - TOKEN_TYPES);
+}
+
+const std::string& Token::getText() const
+{
+	return textOf(textId);
+}
+
+/* 17 significant digits give back the same double, which is what the generated code holds */
+std::string Token::getSpelling() const
+{
+	if (textId != (unsigned int)type || (type != INT_CONST && type != DOUBLE_CONST))
+		return getText();
+	std::ostringstream s;
+	if (type == INT_CONST)
+		s << val.iValue;
+	else
+		s << std::setprecision(17) << val.fValue;
+	return s.str();
+}
+
+void Token::setText(const std::string& _text)
+{
+	textId = internText(_text);
+}
+
+void Token::setText(const char* _text, size_t _length)
+{
+	textId = internText(_text, _length);
+}
+
+const char* Token::getTypeName() const
+{
+	return TOKEN_TYPE_NAMES[type];
+}
+
+int Token::intValue() const
+{
+	return type == DOUBLE_CONST ? (int)val.fValue : val.iValue;
+}
+
+double Token::floatValue() const
+{
+	return type == DOUBLE_CONST ? val.fValue : (double)val.iValue;
+}
+
+const std::string& Token::strValue() const
+{
+	static const std::string nan("nan");
+	return type == STRING_CONST || type == CHAR_CONST ? textOf(val.strId) : nan;
+}
+
+void Token::setStrValue(const std::string& value)
+{
+	val.strId = internText(value);
+}
+
 bool Token::isKeyWord()
 {
-	return strType.substr(0, 2) == "KW";
+	return TOKEN_TYPE_NAMES[type][0] == 'K' && TOKEN_TYPE_NAMES[type][1] == 'W';
 }
 
-void Token::setTag(TokenTypeT t, std::string _strType, std::string _text)
+void Token::setTag(TokenTypeT t, const std::string& _text)
 {
 	type = t;
-	strType = _strType;
-	text = _text;
+	textId = internText(_text);
 }
 
 bool Token::operator==(const Token& t)
 {
-	return type == t.type && strType == t.strType && text == t.text;
+	return type == t.type && getText() == t.getText();
+}
+
+static void locate(unsigned int offset, int& line, int& col)
+{
+	const Source_buffer* source = offset == Token::NO_OFFSET ? NULL : Source_buffer::owner(offset);
+	if (source != NULL)
+		source->locate(offset - source->getBase(), line, col);
+}
+
+int Token::getLine() const
+{
+	int line = 0, col = 0;
+	locate(offset, line, col);
+	return line;
 }
 
-Token::Token(int l, int c)
+int Token::getCol() const
 {
-	type = UNDEFINED;
-	text = "undefined";
-	line = l;
-	col = c;
+	int line = 0, col = 0;
+	locate(offset, line, col);
+	return col;
 }
\ No newline at end of file
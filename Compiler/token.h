@@ -10,29 +10,51 @@ enum TokenTypeT
 #undef TOKEN
 };
 
-typedef struct
-{
-	std::string strValue;
-	int iValue;
-	double fValue;
-}ValueT;
+extern const char* TOKEN_TYPE_NAMES[];
+extern const char* TOKEN_TEXT[];
 
+/*
+	plain 24 byte value: the spelling is interned and referenced by id, the type name comes from TOKEN_TYPE_NAMES and the
+	location is recovered from the offset; a constant made by the compiler keeps textId == type and is spelled from its value
+*/
 class Token
 {
 public:
+	static const unsigned int NO_OFFSET = 0xFFFFFFFF;
+
 	enum TokenTypeT type;
-	std::string text, strType;
-	int line, col;
-	ValueT val;
+	unsigned int offset, length;
+	unsigned int textId;
+	union
+	{
+		int iValue;
+		double fValue;
+		unsigned int strId;
+	}val;
 
 	Token();
-	Token(TokenTypeT _type, std::string _strType, std::string _text);
-	Token(int line, int col);
-	~Token();
+	explicit Token(TokenTypeT _type);
+	Token(TokenTypeT _type, const std::string& _text);
+	explicit Token(unsigned int _offset);
+	Token(TokenTypeT _type, const char* _text, size_t _length);
+	static unsigned int internText(const std::string& text);
+	static unsigned int internText(const char* text, size_t length);
+	static const std::string& textOf(unsigned int id);
+	int getLine() const;
+	int getCol() const;
+	const std::string& getText() const;
+	std::string getSpelling() const;
+	void setText(const std::string& _text);
+	void setText(const char* _text, size_t _length);
+	const char* getTypeName() const;
+	int intValue() const;
+	double floatValue() const;
+	const std::string& strValue() const;
+	void setStrValue(const std::string& value);
 	friend std::ostream& operator<< (std::ostream &s, Token tok);
 	operator TokenTypeT() const;
 	bool isKeyWord();
-	void setTag(TokenTypeT t, std::string _strType, std::string _text);
+	void setTag(TokenTypeT t, const std::string& _text);
 	bool operator==(const Token& t);
 };
 
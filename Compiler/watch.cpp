@@ -0,0 +1,207 @@
+#include "watch.h"
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#define WATCH_INTERVAL 100
+#define COMPARE_BLOCK 4096
+
+static double milliseconds(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+static size_t commonPrefix(const char* a, const char* b, size_t length)
+{
+	size_t i = 0;
+	while (i + COMPARE_BLOCK <= length && memcmp(a + i, b + i, COMPARE_BLOCK) == 0)
+		i += COMPARE_BLOCK;
+	while (i < length && a[i] == b[i])
+		i++;
+	return i;
+}
+
+static size_t commonSuffix(const char* aEnd, const char* bEnd, size_t length)
+{
+	size_t i = 0;
+	while (i + COMPARE_BLOCK <= length && memcmp(aEnd - i - COMPARE_BLOCK, bEnd - i - COMPARE_BLOCK, COMPARE_BLOCK) == 0)
+		i += COMPARE_BLOCK;
+	while (i < length && aEnd[-1 - (long)i] == bEnd[-1 - (long)i])
+		i++;
+	return i;
+}
+
+static bool isBefore(const Token& t, size_t offset)
+{
+	return t.offset < offset;
+}
+
+Watcher::Watcher(const string& _filename) : filename(_filename), source(NULL), scanner(NULL), preprocessor(NULL), parser(NULL), isValid(false), isPlain(false)
+{
+	memset(&status, 0, sizeof(status));
+}
+
+Watcher::~Watcher()
+{
+	release();
+	delete source;
+}
+
+void Watcher::release()
+{
+	delete parser;
+	delete preprocessor;
+	delete scanner;
+	parser = NULL;
+	preprocessor = NULL;
+	scanner = NULL;
+}
+
+bool Watcher::isModified()
+{
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0)
+		return false;
+	bool isSame = st.st_mtime == status.st_mtime && st.st_size == status.st_size && st.st_ino == status.st_ino;
+#ifndef _WIN32
+	isSame = isSame && st.st_mtim.tv_nsec == status.st_mtim.tv_nsec;
+#endif
+	status = st;
+	return !isSame;
+}
+
+/* the text is copied: an editor may rewrite the file in place while it is kept */
+Source_buffer* Watcher::load()
+{
+	FILE* file = fopen(filename.c_str(), "r");
+	if (file == NULL)
+		return NULL;
+	Source_buffer* next = new Source_buffer(file, false);
+	fclose(file);
+	return next;
+}
+
+void Watcher::rebuild(Source_buffer* next)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	release();
+	if (next != source)
+		delete source;
+	source = next;
+	scanner = new Scanner(source, 0, source->size());
+	preprocessor = new Preprocessor(*scanner, filename);
+	parser = new Parser(*preprocessor);
+	parser->setIncremental();
+	try
+	{
+		parser->parse();
+		isValid = true;
+		isPlain = !preprocessor->hasDirectives();
+		cout << "full parse : " << parser->getDeclarationCount() << " declarations, " << milliseconds(start) << " ms" << endl;
+	}
+	catch (CompilerException& error)
+	{
+		isValid = false;
+		cout << error.text() << endl;
+	}
+}
+
+/*
+	lexing restarts at the last token that could run into the edit and
+	stops as soon as a token starts in the unchanged tail where an old one
+	started: from there on the old tokens are valid, only shifted
+*/
+void Watcher::update(Source_buffer* next)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	if (!isPlain)
+	{
+		cout << "preprocessor directives : parsing the whole file" << endl;
+		rebuild(next);
+		return;
+	}
+	size_t oldSize = source->size(), newSize = next->size(), common = min(oldSize, newSize);
+	size_t prefix = commonPrefix(source->begin(), next->begin(), common);
+	if (prefix == common && oldSize == newSize)
+	{
+		delete next;
+		return;
+	}
+	size_t suffix = commonSuffix(source->end(), next->end(), common - prefix);
+	long shift = (long)newSize - (long)oldSize;
+
+	const vector<Token>& tokens = parser->getTokens();
+	size_t first = lower_bound(tokens.begin(), tokens.end(), prefix, isBefore) - tokens.begin();
+	while (first > 0 && tokens[first - 1].offset + tokens[first - 1].length >= prefix)
+		first--;
+	if (first > 0)
+		first--;
+
+	Scanner relexer(next, tokens[first].offset, newSize);
+	vector<Token> replacement;
+	size_t last = tokens.size();
+	while (last == tokens.size())
+	{
+		const Token& t = relexer.next();
+		if (t.offset >= newSize - suffix)
+		{
+			size_t offset = t.offset - shift;
+			vector<Token>::const_iterator old = lower_bound(tokens.begin() + first, tokens.end(), offset, isBefore);
+			if (old != tokens.end() && old->offset == offset)
+			{
+				last = old - tokens.begin();
+				break;
+			}
+		}
+		if (t == OP_HASH)
+		{
+			cout << "preprocessor directive added : parsing the whole file" << endl;
+			rebuild(next);
+			return;
+		}
+		replacement.push_back(t);
+	}
+
+	/* the parser reads positions from its scanner's source, which has to be the new text first */
+	scanner->rebind(next, newSize, newSize);
+	size_t reparsed = parser->update(first, last, replacement, shift);
+	delete source;
+	source = next;
+	cout << "incremental : relexed " << replacement.size() << " tokens, reparsed " << reparsed << " of "
+		<< parser->getDeclarationCount() << " declarations, " << milliseconds(start) << " ms" << endl;
+	/* replaced declarations stay in the arena: once they outweigh the live ones a full parse is cheaper */
+	if (2 * parser->getReplacedBytes() > parser->getArenaBytes())
+		rebuild(source);
+}
+
+void Watcher::run()
+{
+	isModified();
+	Source_buffer* next = load();
+	if (next == NULL)
+	{
+		cout << "Cannot open file " << filename << endl;
+		return;
+	}
+	rebuild(next);
+	for (;;)
+	{
+		this_thread::sleep_for(chrono::milliseconds(WATCH_INTERVAL));
+		if (!isModified() || (next = load()) == NULL)
+			continue;
+		if (!isValid)
+		{
+			rebuild(next);
+			continue;
+		}
+		try
+		{
+			update(next);
+		}
+		catch (CompilerException&)
+		{
+			rebuild(next);
+		}
+	}
+}
@@ -0,0 +1,37 @@
+#ifndef WATCH_H
+#define WATCH_H
+#include "parser.h"
+#include "preprocessor.h"
+#include <sys/stat.h>
+
+/*
+	keeps one file parsed between edits: a change is diffed against the
+	previous text, only the tokens around it are lexed again and the parser
+	re-parses just the declarations they belong to. A file with directives
+	is preprocessed and parsed in full on every change
+*/
+class Watcher
+{
+private :
+
+	string filename;
+	struct stat status;
+	Source_buffer* source;
+	Scanner* scanner;
+	Preprocessor* preprocessor;
+	Parser* parser;
+	bool isValid, isPlain;
+
+	bool isModified();
+	Source_buffer* load();
+	void rebuild(Source_buffer* next);
+	void update(Source_buffer* next);
+	void release();
+public :
+
+	Watcher(const string& _filename);
+	~Watcher();
+	void run();
+};
+
+#endif